@@ -1,6 +1,10 @@
 #include <stdio.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
 #include <boost/foreach.hpp>
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 #include "jsoncpp/json/json.h"
 
@@ -12,7 +16,13 @@
 
 #include "semi_index/json_semi_index.hpp"
 #include "semi_index/path_parser.hpp"
+#include "semi_index/predicate.hpp"
+#include "semi_index/aggregate.hpp"
+#include "semi_index/value_index.hpp"
+#include "semi_index/zone_map.hpp"
+#include "semi_index/shape_index.hpp"
 #include "semi_index/zrandom.hpp"
+#include "semi_index/ordered_parallel_for.hpp"
 
 using json::path::path_element_t;
 using json::path::path_t;
@@ -27,9 +37,22 @@ void nop_stream()
     }
 }
 
-void naive_parse_stream(const char* paths_spec)
+// The naive, BSON and shape extractors only support single-valued paths
+path_list_t parse_single_valued(const char* paths_spec)
 {
     path_list_t paths = json::path::parse(paths_spec);
+    BOOST_FOREACH(path_t const& path, paths) {
+	if (json::path::is_multi_valued(path)) {
+	    std::cerr << "Slices, wildcards and recursive descent need a semi-index command" << std::endl;
+	    exit(1);
+	}
+    }
+    return paths;
+}
+
+void naive_parse_stream(const char* paths_spec)
+{
+    path_list_t paths = parse_single_valued(paths_spec);
     Json::Reader reader;
     Json::FastWriter writer;
     std::string line;
@@ -72,80 +95,313 @@ void naive_parse_stream(const char* paths_spec)
 
 using semi_index::json_semi_index;
 
-void si_parse_stream(const char* paths_spec)
+// Appends to out the JSON list of the values of the trie paths in the
+// document at root, whose text starts at line; multi-valued paths give
+// the list of their matches. Documents rejected by where are skipped
+// before the paths are navigated. values and matches are scratch space
+template <typename Accessor, typename Iterator>
+void append_paths(std::string& out, Accessor const& root, Iterator line,
+		  json::path::path_trie const& trie, json::predicate::expression const& where,
+		  std::vector<Accessor>& values, std::vector<std::pair<size_t, Accessor> >& matches,
+		  semi_index::key_predictor* predictor = 0)
 {
-    path_list_t paths = json::path::parse(paths_spec);
-    std::string line;
+    if (!json::predicate::evaluate(where, root, values, matches)) {
+	return;
+    }
+    using semi_index::detail::append_text;
+    root.get_paths(trie, values, matches, predictor);
+    out += '[';
+    size_t m = 0; // matches are grouped by path
+    for (size_t i = 0; i < values.size(); ++i) {
+	if (i) {
+	    out += ',';
+	}
+
+	if (trie.multi_valued[i]) {
+	    out += '[';
+	    for (size_t first = m; m < matches.size() && matches[m].first == i; ++m) {
+		if (m != first) {
+		    out += ',';
+		}
+		typename Accessor::range_t r = matches[m].second.get_range();
+		append_text(out, line + r.first, line + r.second);
+	    }
+	    out += ']';
+	} else if (values[i].is_valid) {
+	    typename Accessor::range_t r = values[i].get_range();
+	    append_text(out, line + r.first, line + r.second);
+	} else {
+	    out += "null";
+	}
+    }
+    out += "]\n";
+}
+
+void si_parse_stream(const char* paths_spec, json::predicate::expression const& where)
+{
+    json::path::path_trie trie(json::path::parse(paths_spec));
+    std::vector<json_semi_index::accessor> values;
+    std::vector<json_semi_index::path_match> matches;
+    std::string line, out;
     
     while (fast_getline(line)) {
 	json_semi_index index(std::make_pair(&line, &line + 1));
-	json_semi_index::accessor accessor, root = index.get_cursor().get_accessor(line.c_str());
-	fwrite("[", 1, 1, stdout);
-	bool first = true;
-	BOOST_FOREACH(path_t const& path, paths) {
-	    accessor = root.get_path(path);
-	    
-	    if (!first) {
-		fwrite(",", 1, 1, stdout);
-	    } else {
-		first = false;
-	    }
-	    
-	    if (accessor.is_valid) {
-		json_semi_index::accessor::range_t r = accessor.get_range();
-		fwrite(line.c_str() + r.first, r.second - r.first, 1, stdout);
-	    } else {
-		fwrite("null", 4, 1, stdout);
-	    }
-	}
-	fwrite("]\n", 2, 1, stdout);
+	json_semi_index::accessor root = index.get_cursor().get_accessor(line.c_str());
+	out.clear();
+	append_paths(out, root, line.c_str(), trie, where, values, matches);
+	fwrite(out.data(), out.size(), 1, stdout);
     }
 }
 
-void si_save(const char* index_file)
+void si_save(const char* index_file, size_t threads, size_t spill_mb, bool key_index, bool array_index)
+{
+    semi_index::json_semi_index_builder builder;
+    builder.spill_to_disk(spill_mb << 20);
+    builder.key_index(key_index);
+    builder.array_index(array_index);
+    if (threads <= 1) {
+        using succinct::util::lines;
+        builder.append(lines(stdin));
+    } else {
+        // read stdin in batches of whole lines, each batch is indexed
+        // by all the threads
+        std::vector<char> buf(threads << 24);
+        size_t avail = 0;
+        while (true) {
+            size_t read = fread(&buf[avail], 1, buf.size() - avail, stdin);
+            avail += read;
+            bool eof = (avail < buf.size());
+            size_t end = avail;
+            if (!eof) {
+                while (end && buf[end - 1] != '\n') --end;
+                if (!end) {
+                    // a single line larger than the buffer
+                    buf.resize(buf.size() * 2);
+                    continue;
+                }
+            }
+            builder.append_lines(&buf[0], &buf[0] + end, threads);
+            if (eof) break;
+            std::copy(buf.begin() + end, buf.begin() + avail, buf.begin());
+            avail -= end;
+        }
+    }
+    json_semi_index index(&builder);
+    succinct::mapper::size_tree_of(index)->dump();
+    succinct::mapper::freeze(index, index_file);
+}
+
+void si_save_mapped(const char* json_file, const char* index_file, size_t threads, size_t spill_mb,
+		    bool key_index, bool array_index)
+{
+    boost::iostreams::mapped_file_source json_map(json_file);
+    semi_index::json_semi_index_builder builder;
+    builder.spill_to_disk(spill_mb << 20);
+    builder.key_index(key_index);
+    builder.array_index(array_index);
+    builder.append_mapped(json_map, threads);
+    json_semi_index index(&builder);
+    succinct::mapper::size_tree_of(index)->dump();
+    succinct::mapper::freeze(index, index_file);
+}
+
+void shape_save_mapped(const char* json_file, const char* index_file, size_t spill_mb)
 {
-    using succinct::util::lines;
-    json_semi_index index(lines(stdin));
+    boost::iostreams::mapped_file_source json_map(json_file);
+    semi_index::shape_index_builder builder;
+    builder.spill_to_disk(spill_mb << 20);
+    builder.append_lines(json_map.data(), json_map.data() + json_map.size());
+    std::cerr << "Shapes: " << builder.num_shapes() << " documents: " << builder.num_documents() << std::endl;
+    semi_index::shape_index index(builder);
     succinct::mapper::size_tree_of(index)->dump();
     succinct::mapper::freeze(index, index_file);
 }
 
-void saved_si_parse_stream(const char* index_file, const char* paths_spec)
+// As saved_si_parse_mapped, with the single-valued paths resolved once
+// per document shape
+void shape_parse_mapped(const char* json_file, const char* index_file, const char* paths_spec)
+{
+    boost::iostreams::mapped_file_source json_map(json_file);
+    const char* json = json_map.data();
+
+    semi_index::shape_index index;
+    boost::iostreams::mapped_file_source m(index_file);
+    succinct::mapper::map(index, m, succinct::mapper::map_flags::warmup);
+
+    path_list_t paths = parse_single_valued(paths_spec);
+    semi_index::shape_path_resolver resolver(index, paths);
+    std::string out;
+    for (size_t doc = 0; doc < index.num_documents(); ++doc) {
+	out.clear();
+	out += '[';
+	for (size_t i = 0; i < paths.size(); ++i) {
+	    if (i) {
+		out += ',';
+	    }
+	    semi_index::shape_index::range_t r;
+	    if (resolver.get_range(doc, i, r)) {
+		out.append(json + r.first, json + r.second);
+	    } else {
+		out += "null";
+	    }
+	}
+	out += "]\n";
+	fwrite(out.data(), out.size(), 1, stdout);
+    }
+}
+
+// One predictor per thread, or none if prediction is disabled
+struct thread_predictors {
+    thread_predictors(json::path::path_trie const& trie, size_t threads, bool predict)
+    {
+	if (predict) {
+	    m_predictors.resize(threads, semi_index::key_predictor(trie));
+	}
+    }
+
+    semi_index::key_predictor* get(size_t thread) {
+	return m_predictors.empty() ? 0 : &m_predictors[thread];
+    }
+
+    void report() const {
+	if (m_predictors.empty()) return;
+	uint64_t hits = 0, misses = 0;
+	for (size_t i = 0; i < m_predictors.size(); ++i) {
+	    hits += m_predictors[i].hits();
+	    misses += m_predictors[i].misses();
+	}
+	std::cerr << "Key prediction: hits=" << hits << " misses=" << misses
+		  << " hit_rate=" << ((hits + misses) ? double(hits) / (hits + misses) : 0)
+		  << std::endl;
+    }
+
+    std::vector<semi_index::key_predictor> m_predictors;
+};
+
+struct stdout_sink {
+    void operator()(std::string const& out) {
+	fwrite(out.data(), out.size(), 1, stdout);
+    }
+};
+
+// Number of consecutive documents processed by a single parallel task
+static const size_t docs_per_task = 1024;
+
+// Blocks of documents that may satisfy where according to a zone map;
+// without a zone map no document is skipped
+struct zone_filter {
+    zone_filter(const char* zones_file, json_semi_index const& index,
+		json::predicate::expression const& where)
+	: m_block_size(0)
+	, m_skipped_docs(0)
+    {
+	if (!zones_file) return;
+	if (!index.num_documents()) {
+	    std::cerr << "The semi-index has no document index" << std::endl;
+	    exit(1);
+	}
+	semi_index::zone_map zones;
+	boost::iostreams::mapped_file_source m(zones_file);
+	succinct::mapper::map(zones, m);
+	if (zones.num_documents() != index.num_documents()) {
+	    std::cerr << zones_file << " was not built on this semi-index" << std::endl;
+	    exit(1);
+	}
+	m_block_size = zones.block_size();
+	m_selected = semi_index::select_blocks(zones, where);
+	for (size_t b = 0; b < m_selected.size(); ++b) {
+	    if (!m_selected[b]) {
+		m_skipped_docs += std::min(m_block_size, zones.num_documents() - b * m_block_size);
+	    }
+	}
+    }
+
+    bool skip(size_t doc) const {
+	return m_block_size && !m_selected[doc / m_block_size];
+    }
+
+    // First document of the block after the one of doc
+    size_t next_block(size_t doc) const {
+	return (doc / m_block_size + 1) * m_block_size;
+    }
+
+    void report() const {
+	if (!m_block_size) return;
+	size_t skipped = std::count(m_selected.begin(), m_selected.end(), false);
+	std::cerr << "Zone map: blocks=" << m_selected.size() << " hits=" << m_selected.size() - skipped
+		  << " skipped=" << skipped << " skipped_docs=" << m_skipped_docs << std::endl;
+    }
+
+    size_t m_block_size; // 0 without a zone map
+    std::vector<bool> m_selected;
+    size_t m_skipped_docs;
+};
+
+struct mapped_extract_task {
+    mapped_extract_task(json_semi_index const& index, const char* json, json::path::path_trie const& trie,
+			json::predicate::expression const& where, zone_filter const& zones,
+			thread_predictors& predictors)
+	: m_index(index)
+	, m_json(json)
+	, m_trie(trie)
+	, m_where(where)
+	, m_zones(zones)
+	, m_predictors(predictors)
+    {}
+
+    void operator()(size_t thread, size_t task, std::string& out) {
+	size_t first = task * docs_per_task;
+	size_t last = std::min(first + docs_per_task, m_index.num_documents());
+	json_semi_index::cursor cursor = m_index.get_cursor(first);
+	std::vector<json_semi_index::accessor> values;
+	std::vector<json_semi_index::path_match> matches;
+	for (size_t i = first; i < last;) {
+	    if (m_zones.skip(i)) {
+		i = m_zones.next_block(i);
+		if (i < last) cursor = m_index.get_cursor(i);
+		continue;
+	    }
+	    const char* line = m_json + cursor.get_offset();
+	    append_paths(out, cursor.get_accessor(line), line, m_trie, m_where, values, matches,
+			 m_predictors.get(thread));
+	    cursor = cursor.next();
+	    ++i;
+	}
+    }
+
+    json_semi_index const& m_index;
+    const char* m_json;
+    json::path::path_trie const& m_trie;
+    json::predicate::expression const& m_where;
+    zone_filter const& m_zones;
+    thread_predictors& m_predictors;
+};
+
+void saved_si_parse_stream(const char* index_file, const char* paths_spec,
+			   json::predicate::expression const& where)
 {
     json_semi_index index;
     boost::iostreams::mapped_file_source m(index_file);
     succinct::mapper::map(index, m);
     json_semi_index::cursor cursor = index.get_cursor();
 
-    path_list_t paths = json::path::parse(paths_spec);
-    std::string line;
+    json::path::path_trie trie(json::path::parse(paths_spec));
+    std::vector<json_semi_index::accessor> values;
+    std::vector<json_semi_index::path_match> matches;
+    std::string line, out;
     
     while (fast_getline(line)) {
-	json_semi_index::accessor accessor, root = cursor.get_accessor(line.c_str());
+	json_semi_index::accessor root = cursor.get_accessor(line.c_str());
 	cursor = cursor.next();
-	fwrite("[", 1, 1, stdout);
-	bool first = true;
-	BOOST_FOREACH(path_t const& path, paths) {
-	    accessor = root.get_path(path);
-	    
-	    if (!first) {
-		fwrite(",", 1, 1, stdout);
-	    } else {
-		first = false;
-	    }
-	    
-	    if (accessor.is_valid) {
-		json_semi_index::accessor::range_t r = accessor.get_range();
-		fwrite(line.c_str() + r.first, r.second - r.first, 1, stdout);
-	    } else {
-		fwrite("null", 4, 1, stdout);
-	    }
-	}
-	fwrite("]\n", 2, 1, stdout);
+	out.clear();
+	append_paths(out, root, line.c_str(), trie, where, values, matches);
+	fwrite(out.data(), out.size(), 1, stdout);
     }
 }
 
-void saved_si_parse_mapped(const char* json_file, const char* index_file, const char* paths_spec)
+void saved_si_parse_mapped(const char* json_file, const char* index_file, const char* paths_spec,
+			   json::predicate::expression const& where, const char* zones_file,
+			   size_t threads, bool predict)
 {
     boost::iostreams::mapped_file_source json_map(json_file);
     const char* json = json_map.data();
@@ -155,72 +411,307 @@ void saved_si_parse_mapped(const char* json_file, const char* index_file, const
     succinct::mapper::map(index, m, succinct::mapper::map_flags::warmup);
     json_semi_index::cursor cursor = index.get_cursor();
 
-    path_list_t paths = json::path::parse(paths_spec);
-    
+    json::path::path_trie trie(json::path::parse(paths_spec));
+    thread_predictors predictors(trie, threads, predict);
+    zone_filter zones(zones_file, index, where);
+
+    if (threads > 1 && index.num_documents()) {
+	mapped_extract_task task(index, json, trie, where, zones, predictors);
+	stdout_sink sink;
+	size_t num_tasks = (index.num_documents() + docs_per_task - 1) / docs_per_task;
+	semi_index::ordered_parallel_for(num_tasks, threads, task, sink);
+	predictors.report();
+	zones.report();
+	return;
+    }
+
+    std::vector<json_semi_index::accessor> values;
+    std::vector<json_semi_index::path_match> matches;
+    std::string out;
+    size_t doc = 0;
     while (!(cursor == json_semi_index::cursor())) {
+	if (zones.skip(doc)) {
+	    // whole blocks are skipped without touching their documents
+	    doc = zones.next_block(doc);
+	    cursor = (doc < index.num_documents()) ? index.get_cursor(doc) : json_semi_index::cursor();
+	    continue;
+	}
 	const char* line = json + cursor.get_offset();
-	json_semi_index::accessor accessor, root = cursor.get_accessor(line);
+	json_semi_index::accessor root = cursor.get_accessor(line);
 	cursor = cursor.next();
-	fwrite("[", 1, 1, stdout);
-	bool first = true;
-	BOOST_FOREACH(path_t const& path, paths) {
-	    accessor = root.get_path(path);
-	    
-	    if (!first) {
-		fwrite(",", 1, 1, stdout);
-	    } else {
-		first = false;
+	++doc;
+	out.clear();
+	append_paths(out, root, line, trie, where, values, matches, predictors.get(0));
+	fwrite(out.data(), out.size(), 1, stdout);
+    }
+    predictors.report();
+    zones.report();
+}
+
+struct null_sink {
+    void operator()(std::string const&) {}
+};
+
+typedef semi_index::aggregator<json_semi_index::accessor> json_aggregator;
+
+// Aggregates the documents of each task in the aggregator of its thread
+struct aggregate_task {
+    aggregate_task(json_semi_index const& index, const char* json, json::predicate::expression const& where,
+		   zone_filter const& zones, boost::ptr_vector<json_aggregator>& aggregators)
+	: m_index(index)
+	, m_json(json)
+	, m_where(where)
+	, m_zones(zones)
+	, m_aggregators(aggregators)
+    {}
+
+    void operator()(size_t thread, size_t task, std::string& /* out */) {
+	size_t first = task * docs_per_task;
+	size_t last = std::min(first + docs_per_task, m_index.num_documents());
+	json_semi_index::cursor cursor = m_index.get_cursor(first);
+	std::vector<json_semi_index::accessor> values;
+	std::vector<json_semi_index::path_match> matches;
+	for (size_t i = first; i < last;) {
+	    if (m_zones.skip(i)) {
+		i = m_zones.next_block(i);
+		if (i < last) cursor = m_index.get_cursor(i);
+		continue;
 	    }
-	    
-	    if (accessor.is_valid) {
-		json_semi_index::accessor::range_t r = accessor.get_range();
-		fwrite(line + r.first, r.second - r.first, 1, stdout);
-	    } else {
-		fwrite("null", 4, 1, stdout);
+	    const char* line = m_json + cursor.get_offset();
+	    json_semi_index::accessor root = cursor.get_accessor(line);
+	    if (json::predicate::evaluate(m_where, root, values, matches)) {
+		m_aggregators[thread].add(root, line);
 	    }
+	    cursor = cursor.next();
+	    ++i;
 	}
-	fwrite("]\n", 2, 1, stdout);
     }
+
+    json_semi_index const& m_index;
+    const char* m_json;
+    json::predicate::expression const& m_where;
+    zone_filter const& m_zones;
+    boost::ptr_vector<json_aggregator>& m_aggregators;
+};
+
+// Group-by aggregation of the documents that satisfy where, written as
+// one JSON object per group
+void aggregate(const char* json_file, const char* index_file, const char* group_by, const char* aggregates,
+	       json::predicate::expression const& where, const char* zones_file, size_t threads)
+{
+    semi_index::aggregate_spec spec = semi_index::parse_aggregate_spec(group_by, aggregates);
+
+    boost::iostreams::mapped_file_source json_map(json_file);
+    const char* json = json_map.data();
+
+    json_semi_index index;
+    boost::iostreams::mapped_file_source m(index_file);
+    succinct::mapper::map(index, m, succinct::mapper::map_flags::warmup);
+
+    // one partial aggregate per thread, merged at the end
+    threads = std::max(threads, size_t(1));
+    boost::ptr_vector<json_aggregator> aggregators;
+    for (size_t t = 0; t < threads; ++t) {
+	aggregators.push_back(new json_aggregator(spec));
+    }
+    zone_filter zones(zones_file, index, where);
+    aggregate_task task(index, json, where, zones, aggregators);
+    size_t num_tasks = (index.num_documents() + docs_per_task - 1) / docs_per_task;
+    if (threads > 1) {
+	null_sink sink;
+	semi_index::ordered_parallel_for(num_tasks, threads, task, sink);
+    } else {
+	std::string out;
+	for (size_t i = 0; i < num_tasks; ++i) {
+	    task(0, i, out);
+	}
+    }
+    for (size_t t = 1; t < threads; ++t) {
+	aggregators[0].merge(aggregators[t]);
+    }
+
+    std::string out;
+    aggregators[0].write(out);
+    fwrite(out.data(), out.size(), 1, stdout);
+    zones.report();
+}
+
+// Summaries of the values of paths_spec in each block of block_size
+// documents, used by --zones to skip the blocks that cannot satisfy
+// --where
+void build_zone_map(const char* json_file, const char* index_file, const char* paths_spec,
+		    const char* zones_file, size_t block_size)
+{
+    boost::iostreams::mapped_file_source json_map(json_file);
+    const char* json = json_map.data();
+
+    json_semi_index index;
+    boost::iostreams::mapped_file_source m(index_file);
+    succinct::mapper::map(index, m, succinct::mapper::map_flags::warmup);
+
+    semi_index::zone_map_builder builder(paths_spec, block_size);
+    json_semi_index::cursor cursor = index.get_cursor();
+    while (!(cursor == json_semi_index::cursor())) {
+	const char* line = json + cursor.get_offset();
+	builder.add(cursor.get_accessor(line));
+	cursor = cursor.next();
+    }
+    semi_index::zone_map zones(builder);
+    succinct::mapper::size_tree_of(zones)->dump();
+    succinct::mapper::freeze(zones, zones_file);
+}
+
+// Inverted index of the values of path_spec in each document
+void build_value_index(const char* json_file, const char* index_file, const char* path_spec,
+		       const char* value_index_file)
+{
+    boost::iostreams::mapped_file_source json_map(json_file);
+    const char* json = json_map.data();
+
+    json_semi_index index;
+    boost::iostreams::mapped_file_source m(index_file);
+    succinct::mapper::map(index, m, succinct::mapper::map_flags::warmup);
+    if (!index.num_documents()) {
+	std::cerr << "The semi-index has no document index" << std::endl;
+	exit(1);
+    }
+
+    semi_index::value_index_builder builder(path_spec);
+    json_semi_index::cursor cursor = index.get_cursor();
+    for (size_t i = 0; i < index.num_documents(); ++i) {
+	const char* line = json + cursor.get_offset();
+	builder.add(cursor.get_accessor(line), line);
+	cursor = cursor.next();
+    }
+    semi_index::value_index values(builder);
+    succinct::mapper::size_tree_of(values)->dump();
+    succinct::mapper::freeze(values, value_index_file);
 }
 
-void saved_si_parse_compressed(const char* json_compressed_file, const char* index_file, const char* paths_spec)
+// Extracts the paths from the documents that satisfy the equality or IN
+// conditions, given as pairs of value index and value list in args.
+// Only the matching documents are visited, through the document index
+void value_index_lookup(const char* json_file, const char* index_file, const char* paths_spec,
+			char** args, int num_args, json::predicate::expression const& where)
 {
-    zrandom::decompressor json_dec(json_compressed_file);
+    if (num_args == 0 || num_args % 2) {
+	std::cerr << "Expected pairs of value index and value list" << std::endl;
+	exit(1);
+    }
+
+    boost::iostreams::mapped_file_source json_map(json_file);
+    const char* json = json_map.data();
+
+    json_semi_index index;
+    boost::iostreams::mapped_file_source m(index_file);
+    succinct::mapper::map(index, m);
+
+    std::vector<boost::iostreams::mapped_file_source> value_maps;
+    boost::ptr_vector<semi_index::value_index> value_indexes;
+    std::vector<semi_index::value_condition> conditions;
+    for (int i = 0; i < num_args; i += 2) {
+	value_maps.push_back(boost::iostreams::mapped_file_source(args[i]));
+	value_indexes.push_back(new semi_index::value_index);
+	succinct::mapper::map(value_indexes.back(), value_maps.back());
+	if (value_indexes.back().num_documents() != index.num_documents()) {
+	    std::cerr << args[i] << " was not built on this semi-index" << std::endl;
+	    exit(1);
+	}
+	semi_index::value_condition cond;
+	cond.index = &value_indexes.back();
+	cond.values = semi_index::parse_value_list(args[i + 1]);
+	conditions.push_back(cond);
+    }
+
+    std::vector<uint64_t> docs;
+    semi_index::intersect_postings(conditions, docs);
+
+    json::path::path_trie trie(json::path::parse(paths_spec));
+    std::vector<json_semi_index::accessor> values;
+    std::vector<json_semi_index::path_match> matches;
+    std::string out;
+    for (size_t i = 0; i < docs.size(); ++i) {
+	json_semi_index::cursor cursor = index.get_cursor(docs[i]);
+	const char* line = json + cursor.get_offset();
+	out.clear();
+	append_paths(out, cursor.get_accessor(line), line, trie, where, values, matches);
+	fwrite(out.data(), out.size(), 1, stdout);
+    }
+}
+
+typedef semi_index::json_semi_index_base<zrandom::decompressor::iterator> json_semi_index_z;
+
+struct compressed_extract_task {
+    // the threads share the decompressor and its block cache
+    compressed_extract_task(json_semi_index_z const& index, zrandom::decompressor const& json_dec,
+			    json::path::path_trie const& trie, json::predicate::expression const& where,
+			    thread_predictors& predictors)
+	: m_index(index)
+	, m_dec(json_dec)
+	, m_trie(trie)
+	, m_where(where)
+	, m_predictors(predictors)
+    {}
+
+    void operator()(size_t thread, size_t task, std::string& out) {
+	zrandom::decompressor::iterator json = m_dec.begin();
+	size_t first = task * docs_per_task;
+	size_t last = std::min(first + docs_per_task, m_index.num_documents());
+	json_semi_index_z::cursor cursor = m_index.get_cursor(first);
+	std::vector<json_semi_index_z::accessor> values;
+	std::vector<json_semi_index_z::path_match> matches;
+	for (size_t i = first; i < last; ++i) {
+	    zrandom::decompressor::iterator line = json + cursor.get_offset();
+	    append_paths(out, cursor.get_accessor(line), line, m_trie, m_where, values, matches,
+			 m_predictors.get(thread));
+	    cursor = cursor.next();
+	}
+    }
+
+    json_semi_index_z const& m_index;
+    zrandom::decompressor const& m_dec;
+    json::path::path_trie const& m_trie;
+    json::predicate::expression const& m_where;
+    thread_predictors& m_predictors;
+};
+
+void saved_si_parse_compressed(const char* json_compressed_file, const char* index_file, const char* paths_spec,
+			       json::predicate::expression const& where, size_t threads, bool predict,
+			       size_t cache_mb)
+{
+    zrandom::decompressor json_dec(json_compressed_file,
+				   cache_mb ? cache_mb << 20 : size_t(zrandom::decompressor::default_cache_bytes));
     zrandom::decompressor::iterator json = json_dec.begin();
 
-    typedef semi_index::json_semi_index_base<zrandom::decompressor::iterator> json_semi_index_z;
     json_semi_index_z index;
     boost::iostreams::mapped_file_source m(index_file);
     succinct::mapper::map(index, m);
     json_semi_index_z::cursor cursor = index.get_cursor();
 
-    path_list_t paths = json::path::parse(paths_spec);
-    
+    json::path::path_trie trie(json::path::parse(paths_spec));
+    thread_predictors predictors(trie, threads, predict);
+
+    if (threads > 1 && index.num_documents()) {
+	compressed_extract_task task(index, json_dec, trie, where, predictors);
+	stdout_sink sink;
+	size_t num_tasks = (index.num_documents() + docs_per_task - 1) / docs_per_task;
+	semi_index::ordered_parallel_for(num_tasks, threads, task, sink);
+	predictors.report();
+	return;
+    }
+
+    std::vector<json_semi_index_z::accessor> values;
+    std::vector<json_semi_index_z::path_match> matches;
+    std::string out;
     while (!(cursor == json_semi_index_z::cursor())) {
 	zrandom::decompressor::iterator line = json + cursor.get_offset();
-	json_semi_index_z::accessor accessor, root = cursor.get_accessor(line);
+	json_semi_index_z::accessor root = cursor.get_accessor(line);
 	cursor = cursor.next();
-	fwrite("[", 1, 1, stdout);
-	bool first = true;
-	BOOST_FOREACH(path_t const& path, paths) {
-	    accessor = root.get_path(path);
-	    
-	    if (!first) {
-		fwrite(",", 1, 1, stdout);
-	    } else {
-		first = false;
-	    }
-	    
-	    if (accessor.is_valid) {
-		json_semi_index_z::accessor::range_t r = accessor.get_range();
-		std::string val(line + r.first, line + r.second);
-		fwrite(val.c_str(), val.size(), 1, stdout);
-	    } else {
-		fwrite("null", 4, 1, stdout);
-	    }
-	}
-	fwrite("]\n", 2, 1, stdout);
+	out.clear();
+	append_paths(out, root, line, trie, where, values, matches, predictors.get(0));
+	fwrite(out.data(), out.size(), 1, stdout);
     }
+    predictors.report();
 }
 
 void bson_save(const char* output_file)
@@ -239,7 +730,7 @@ void bson_parse_mapped(const char* bson_file, const char* paths_spec)
     const char* bson = bson_map.data();
     const char* bson_end = bson + bson_map.size();
 
-    path_list_t paths = json::path::parse(paths_spec);
+    path_list_t paths = parse_single_valued(paths_spec);
     
     const char* cur = bson;
     while (cur != bson_end) {
@@ -306,6 +797,19 @@ void bson_parse_mapped(const char* bson_file, const char* paths_spec)
     }
 }
 
+// Value of a numeric option, exits if it is not an integer >= min_value
+long option_value(std::string const& opt, const char* value, long min_value)
+{
+    char* end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (!*value || *end || errno || v < min_value) {
+	std::cerr << "Invalid value for option " << opt << ": " << value << std::endl;
+	exit(1);
+    }
+    return v;
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2) {
@@ -314,22 +818,107 @@ int main(int argc, char** argv)
     }
 	
     std::string cmd(argv[1]);
+    size_t threads = 1;
+    size_t spill_mb = 0;
+    size_t cache_mb = 0;
+    int level = 9;
+    size_t block_bytes = zrandom::default_block_size;
+    bool predict = false;
+    bool key_index = false;
+    bool array_index = false;
+    bool align_lines = false;
+    const char* zones_file = 0;
+    size_t block_size = docs_per_task;
+    json::predicate::expression where;
+    while (argc >= 3 && argv[2][0] == '-') {
+	std::string opt(argv[2]);
+	int consumed = 2;
+	if (opt == "--predict") {
+	    predict = true;
+	    consumed = 1;
+	} else if (opt == "--keys") {
+	    key_index = true;
+	    consumed = 1;
+	} else if (opt == "--arrays") {
+	    array_index = true;
+	    consumed = 1;
+	} else if (opt == "--align") {
+	    align_lines = true;
+	    consumed = 1;
+	} else if (argc < 4) {
+	    std::cerr << "Missing value for option " << opt << std::endl;
+	    exit(1);
+	} else if (opt == "-j") {
+	    threads = option_value(opt, argv[3], 1);
+	} else if (opt == "--spill") {
+	    spill_mb = option_value(opt, argv[3], 0);
+	} else if (opt == "--cache") {
+	    cache_mb = option_value(opt, argv[3], 0);
+	} else if (opt == "--level") {
+	    level = option_value(opt, argv[3], -1);
+	} else if (opt == "--block-bytes") {
+	    block_bytes = option_value(opt, argv[3], 1);
+	} else if (opt == "--where") {
+	    where = json::predicate::parse(argv[3]);
+	} else if (opt == "--zones") {
+	    zones_file = argv[3];
+	} else if (opt == "--block") {
+	    block_size = option_value(opt, argv[3], 1);
+	} else {
+	    std::cerr << "Unknown option: " << opt << std::endl;
+	    exit(1);
+	}
+	// drop the option so that positional arguments keep their indices
+	argv += consumed;
+	argc -= consumed;
+    }
+
+    if (!where.empty() && (cmd == "naive_parse_stream" || cmd == "bson_parse_mapped" ||
+			   cmd == "shape_parse_mapped")) {
+	std::cerr << "--where needs a semi-index command" << std::endl;
+	exit(1);
+    }
+
+    if (zones_file && cmd != "saved_si_parse_mapped" && cmd != "aggregate") {
+	std::cerr << "--zones is only supported by saved_si_parse_mapped and aggregate" << std::endl;
+	exit(1);
+    }
+
     if (cmd == "nop_stream") {
 	nop_stream();
     } else if (cmd == "naive_parse_stream") {
 	naive_parse_stream(argv[2]);
     } else if (cmd == "si_parse_stream") {
-	si_parse_stream(argv[2]);
+	si_parse_stream(argv[2], where);
     } else if (cmd == "si_save") {
-	si_save(argv[2]);
+	si_save(argv[2], threads, spill_mb, key_index, array_index);
+    } else if (cmd == "si_save_mapped") {
+	si_save_mapped(argv[2], argv[3], threads, spill_mb, key_index, array_index);
+    } else if (cmd == "shape_save_mapped") {
+	shape_save_mapped(argv[2], argv[3], spill_mb);
+    } else if (cmd == "shape_parse_mapped") {
+	shape_parse_mapped(argv[2], argv[3], argv[4]);
     } else if (cmd == "saved_si_parse_stream") {
-	saved_si_parse_stream(argv[2], argv[3]);
+	saved_si_parse_stream(argv[2], argv[3], where);
     } else if (cmd == "saved_si_parse_mapped") {
-	saved_si_parse_mapped(argv[2], argv[3], argv[4]);
+	saved_si_parse_mapped(argv[2], argv[3], argv[4], where, zones_file, threads, predict);
+    } else if (cmd == "aggregate") {
+	aggregate(argv[2], argv[3], argv[4], argv[5], where, zones_file, threads);
+    } else if (cmd == "build_zone_map") {
+	build_zone_map(argv[2], argv[3], argv[4], argv[5], block_size);
+    } else if (cmd == "build_value_index") {
+	build_value_index(argv[2], argv[3], argv[4], argv[5]);
+    } else if (cmd == "value_index_lookup") {
+	value_index_lookup(argv[2], argv[3], argv[4], argv + 5, argc - 5, where);
     } else if (cmd == "compress_file") {
-        zrandom::compress(argv[2], argv[3]);
+	try {
+	    zrandom::compress(argv[2], argv[3], threads, level, block_bytes, align_lines);
+	} catch (std::exception const& e) {
+	    std::cerr << e.what() << std::endl;
+	    exit(1);
+	}
     } else if (cmd == "saved_si_parse_compressed") {
-	saved_si_parse_compressed(argv[2], argv[3], argv[4]);
+	saved_si_parse_compressed(argv[2], argv[3], argv[4], where, threads, predict, cache_mb);
     } else if (cmd == "bson_save") {
 	bson_save(argv[2]);
     } else if (cmd == "bson_parse_mapped") {
@@ -4,6 +4,7 @@
 #include <set>
 #include <limits>
 #include <algorithm>
+#include <sstream>
 
 #include <boost/foreach.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
@@ -14,9 +15,69 @@
 #include "succinct/mapper.hpp"
 
 #include "semi_index/json_semi_index.hpp"
+#include "semi_index/ordered_parallel_for.hpp"
 
 #include "perftest_common.hpp"
 
+// Collects the arrays in the subtree of value, walking it with children()
+void collect_arrays(semi_index::json_semi_index::accessor const& value,
+                    std::vector<semi_index::json_semi_index::accessor>& arrays)
+{
+    semi_index::value_type type = value.type();
+    if (type != semi_index::array_type && type != semi_index::object_type) {
+        return;
+    }
+    if (type == semi_index::array_type) {
+        arrays.push_back(value);
+    }
+    BOOST_FOREACH(semi_index::json_semi_index::accessor const& child, value.children()) {
+        collect_arrays(child, arrays);
+    }
+}
+
+// Extracts the ranges of the given paths from docs_per_task documents
+struct extract_task {
+    static const size_t docs_per_task = 1024;
+
+    extract_task(semi_index::json_semi_index const& index,
+                 std::vector<std::string> const& json_strings,
+                 json::path::path_list_t const& paths)
+        : m_index(index)
+        , m_json_strings(json_strings)
+        , m_paths(paths)
+    {}
+
+    size_t num_tasks() const {
+        return (m_json_strings.size() + docs_per_task - 1) / docs_per_task;
+    }
+
+    void operator()(size_t /* thread */, size_t task, std::string& out) {
+        size_t first = task * docs_per_task;
+        size_t last = std::min(first + docs_per_task, m_json_strings.size());
+        semi_index::json_semi_index::cursor cursor = m_index.get_cursor(first);
+        for (size_t idx = first; idx < last; ++idx) {
+            const char* json = m_json_strings[idx].c_str();
+            semi_index::json_semi_index::accessor accessor, root = cursor.get_accessor(json);
+            BOOST_FOREACH(json::path::path_t const& path, m_paths) {
+                accessor = root.get_path(path);
+                if (accessor.is_valid) {
+                    semi_index::json_semi_index::accessor::range_t r = accessor.get_range();
+                    out.append(json + r.first, json + r.second);
+                }
+            }
+            cursor = cursor.next();
+        }
+    }
+
+    semi_index::json_semi_index const& m_index;
+    std::vector<std::string> const& m_json_strings;
+    json::path::path_list_t const& m_paths;
+};
+
+struct null_sink {
+    void operator()(std::string const&) {}
+};
+
 int main(int argc, char** argv)
 {
     srand(42); 
@@ -83,13 +144,36 @@ int main(int argc, char** argv)
         }
     }
 
-    TIMEIT("json_semi_index building:", runs * json_strings.size()) {
+    size_t total_json = 0;
+    BOOST_FOREACH(std::string const& json, json_strings) {
+        total_json += json.size();
+    }
+
+    TIMEIT_BYTES("Structural scan (scalar):", runs * json_strings.size(), runs * total_json) {
+        for (size_t i = 0; i < runs; ++i) {
+            succinct::bit_vector_builder nav, bp;
+            BOOST_FOREACH(std::string const& json, json_strings) {
+                semi_index::scan_json_scalar(json.begin(), json.end(), nav, bp);
+            }
+        }
+    }
+
+    TIMEIT_BYTES("Structural scan (SIMD):", runs * json_strings.size(), runs * total_json) {
+        for (size_t i = 0; i < runs; ++i) {
+            succinct::bit_vector_builder nav, bp;
+            BOOST_FOREACH(std::string const& json, json_strings) {
+                semi_index::scan_json_simd(json.c_str(), json.c_str() + json.size(), nav, bp);
+            }
+        }
+    }
+
+    TIMEIT_BYTES("json_semi_index building:", runs * json_strings.size(), runs * total_json) {
         for (size_t i = 0; i < runs; ++i) {
                 semi_index::json_semi_index index(json_strings);
         }
     }
 
-    TIMEIT("JsonCpp parsing:", runs * json_strings.size()) {
+    TIMEIT_BYTES("JsonCpp parsing:", runs * json_strings.size(), runs * total_json) {
         Json::Reader reader;
         for (size_t i = 0; i < runs; ++i) {
             BOOST_FOREACH(std::string const& json, json_strings) {
@@ -114,7 +198,16 @@ int main(int argc, char** argv)
 //         }
 //     }
 
-    TIMEIT("Spirit2 parsing:", runs * json_strings.size()) {
+    TIMEIT_BYTES("Spirit2 parsing:", runs * json_strings.size(), runs * total_json) {
+        for (size_t i = 0; i < runs; ++i) {
+            BOOST_FOREACH(std::string const& json, json_strings) {
+                json::parser::value root;
+                json::parser::spirit_parse(json, root);
+            }
+        }
+    }
+
+    TIMEIT_BYTES("Hand-written parsing:", runs * json_strings.size(), runs * total_json) {
         for (size_t i = 0; i < runs; ++i) {
             BOOST_FOREACH(std::string const& json, json_strings) {
                 json::parser::value root;
@@ -123,6 +216,16 @@ int main(int argc, char** argv)
         }
     }
 
+    TIMEIT_BYTES("Arena DOM parsing:", runs * json_strings.size(), runs * total_json) {
+        json::parser::arena a;
+        for (size_t i = 0; i < runs; ++i) {
+            BOOST_FOREACH(std::string const& json, json_strings) {
+                a.reset();
+                json::parser::parse(json.c_str(), json.c_str() + json.size(), a);
+            }
+        }
+    }
+
     runs *= 100;
 
     using json::path::path_element_t;
@@ -135,11 +238,6 @@ int main(int argc, char** argv)
         semi_index::json_semi_index index(json_strings);
 	size_t index_size = succinct::mapper::size_of(index);
 
-        size_t total_json = 0;
-        BOOST_FOREACH(std::string const& json, json_strings) {
-            total_json += json.size();
-        }
-
 	std::cerr << "Total JSON: " << total_json
 		  << " json_semi_index overhead: " << (double)index_size / total_json
                   << std::endl;
@@ -160,6 +258,145 @@ int main(int argc, char** argv)
                 }
             }
         }
+
+        json::path::path_trie trie(paths);
+        std::vector<semi_index::json_semi_index::accessor> values;
+        TIMEIT("Accessing elements with json_semi_index (path trie):", runs * json_strings.size()) {
+            for (size_t i = 0; i < runs; ++i) {
+		semi_index::json_semi_index::cursor cursor = index.get_cursor();
+                for (size_t idx = 0; idx < json_strings.size(); ++idx) {
+                    cursor.get_accessor(json_strings[idx].c_str()).get_paths(trie, values);
+                    for (size_t p = 0; p < values.size(); ++p) {
+                        if (values[p].is_valid)
+                            values[p].parse();
+                    }
+		    cursor = cursor.next();
+                }
+            }
+        }
+
+        TIMEIT("Accessing elements with json_semi_index (path trie, arena DOM):", runs * json_strings.size()) {
+            json::parser::arena a;
+            for (size_t i = 0; i < runs; ++i) {
+		semi_index::json_semi_index::cursor cursor = index.get_cursor();
+                for (size_t idx = 0; idx < json_strings.size(); ++idx) {
+                    a.reset();
+                    cursor.get_accessor(json_strings[idx].c_str()).get_paths(trie, values);
+                    for (size_t p = 0; p < values.size(); ++p) {
+                        if (values[p].is_valid)
+                            values[p].parse(a);
+                    }
+		    cursor = cursor.next();
+                }
+            }
+        }
+
+        // decoding the extracted values, with the generic parser and
+        // with the typed accessors
+        std::vector<semi_index::json_semi_index::accessor> leaves;
+        {
+            semi_index::json_semi_index::cursor cursor = index.get_cursor();
+            for (size_t idx = 0; idx < json_strings.size(); ++idx) {
+                cursor.get_accessor(json_strings[idx].c_str()).get_paths(trie, values);
+                for (size_t p = 0; p < values.size(); ++p) {
+                    semi_index::value_type type = values[p].type();
+                    if (type != semi_index::invalid_type &&
+                        type != semi_index::array_type &&
+                        type != semi_index::object_type) {
+                        leaves.push_back(values[p]);
+                    }
+                }
+                cursor = cursor.next();
+            }
+        }
+        std::cerr << leaves.size() << " scalar values." << std::endl;
+
+        TIMEIT("Decoding scalars with parse():", runs * leaves.size()) {
+            for (size_t i = 0; i < runs; ++i) {
+                BOOST_FOREACH(semi_index::json_semi_index::accessor const& leaf, leaves) {
+                    leaf.parse();
+                }
+            }
+        }
+
+        TIMEIT("Decoding scalars with typed accessors:", runs * leaves.size()) {
+            std::string buffer;
+            for (size_t i = 0; i < runs; ++i) {
+                BOOST_FOREACH(semi_index::json_semi_index::accessor const& leaf, leaves) {
+                    switch (leaf.type()) {
+                    case semi_index::number_type: {
+                        volatile double x = leaf.as_double(); (void)x;
+                        break;
+                    }
+                    case semi_index::bool_type: {
+                        volatile bool x = leaf.as_bool(); (void)x;
+                        break;
+                    }
+                    case semi_index::string_type: {
+                        volatile const char* x = leaf.as_unescaped_string(buffer).first; (void)x;
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+                }
+            }
+        }
+
+        TIMEIT("Raw strings with typed accessors:", runs * leaves.size()) {
+            for (size_t i = 0; i < runs; ++i) {
+                BOOST_FOREACH(semi_index::json_semi_index::accessor const& leaf, leaves) {
+                    if (leaf.type() == semi_index::string_type) {
+                        volatile const char* x = leaf.as_raw_string().first; (void)x;
+                    }
+                }
+            }
+        }
+
+        std::vector<semi_index::json_semi_index::accessor> arrays;
+        {
+            semi_index::json_semi_index::cursor cursor = index.get_cursor();
+            for (size_t idx = 0; idx < json_strings.size(); ++idx) {
+                collect_arrays(cursor.get_accessor(json_strings[idx].c_str()), arrays);
+                cursor = cursor.next();
+            }
+        }
+        size_t elements = 0;
+        BOOST_FOREACH(semi_index::json_semi_index::accessor const& array, arrays) {
+            elements += array.size();
+        }
+        std::cerr << arrays.size() << " arrays, " << elements << " elements." << std::endl;
+
+        TIMEIT("Iterating arrays with operator[]:", runs * elements) {
+            for (size_t i = 0; i < runs; ++i) {
+                BOOST_FOREACH(semi_index::json_semi_index::accessor const& array, arrays) {
+                    for (int64_t e = 0; array[e].is_valid; ++e) {}
+                }
+            }
+        }
+
+        TIMEIT("Iterating arrays with children():", runs * elements) {
+            for (size_t i = 0; i < runs; ++i) {
+                BOOST_FOREACH(semi_index::json_semi_index::accessor const& array, arrays) {
+                    BOOST_FOREACH(semi_index::json_semi_index::accessor const& element, array.children()) {
+                        (void)element;
+                    }
+                }
+            }
+        }
+
+        size_t max_threads = std::max(1U, boost::thread::hardware_concurrency());
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            std::ostringstream msg;
+            msg << "Parallel extraction with json_semi_index, threads=" << threads << ":";
+            extract_task task(index, json_strings, paths);
+            null_sink sink;
+            TIMEIT(msg.str(), runs * json_strings.size()) {
+                for (size_t i = 0; i < runs; ++i) {
+                    semi_index::ordered_parallel_for(task.num_tasks(), threads, task, sink);
+                }
+            }
+        }
     }
     
     {
@@ -5,10 +5,11 @@
 namespace detail {
 
     struct timer {
-	timer(const std::string msg) 
+	timer(const std::string msg, size_t bytes = 0) 
 	    : m_msg(msg)
 	    , m_tick(boost::posix_time::microsec_clock::universal_time())
 	    , m_done(false)
+	    , m_bytes(bytes)
 	{}
     
 	bool done() { return m_done; } 
@@ -19,6 +20,9 @@ namespace detail {
 	    if (n > 1) {
 		std::cerr << " n=" << n << " single=" << elapsed_usec / n << "us";
 	    }
+	    if (m_bytes && elapsed_usec) {
+		std::cerr << " throughput=" << m_bytes / (elapsed_usec * 1000) << "GB/s";
+	    }
 	    std::cerr << std::endl;
 	    m_done = true;
 	}
@@ -26,7 +30,9 @@ namespace detail {
 	const std::string m_msg;
 	boost::posix_time::ptime m_tick;
 	bool m_done;
+	size_t m_bytes;
     };
 }
 
 #define TIMEIT(msg, n) for (detail::timer TIMEIT_timer(msg); !TIMEIT_timer.done(); TIMEIT_timer.report(n))
+#define TIMEIT_BYTES(msg, n, bytes) for (detail::timer TIMEIT_timer(msg, bytes); !TIMEIT_timer.done(); TIMEIT_timer.report(n))
@@ -0,0 +1,86 @@
+#include "aggregate.hpp"
+
+#include <stdexcept>
+
+namespace semi_index {
+
+    namespace {
+        std::vector<std::string> split(std::string const& s, char sep)
+        {
+            std::vector<std::string> parts;
+            size_t begin = 0;
+            while (true) {
+                size_t end = s.find(sep, begin);
+                parts.push_back(s.substr(begin, end - begin));
+                if (end == std::string::npos) break;
+                begin = end + 1;
+            }
+            return parts;
+        }
+
+        std::string trim(std::string const& s)
+        {
+            size_t begin = 0, end = s.size();
+            while (begin != end && detail::is_json_space(s[begin])) ++begin;
+            while (end != begin && detail::is_json_space(s[end - 1])) --end;
+            return s.substr(begin, end - begin);
+        }
+
+        void error(std::string const& what)
+        {
+            throw std::invalid_argument("Invalid aggregate: \"" + what + "\"");
+        }
+    }
+
+    aggregate_spec parse_aggregate_spec(std::string const& group_by, std::string const& aggregates)
+    {
+        aggregate_spec spec;
+        json::path::path_list_t paths;
+        if (!trim(group_by).empty()) {
+            paths = json::path::parse(group_by);
+            spec.group_names = split(group_by, ',');
+            if (spec.group_names.size() != paths.size()) {
+                throw std::invalid_argument("Invalid group-by paths: \"" + group_by + "\"");
+            }
+        }
+        for (size_t g = 0; g < paths.size(); ++g) {
+            spec.group_names[g] = trim(spec.group_names[g]);
+            if (json::path::is_multi_valued(paths[g])) {
+                throw std::invalid_argument("Group-by paths must be single-valued: \"" +
+                                            spec.group_names[g] + "\"");
+            }
+        }
+
+        std::vector<std::string> names = split(aggregates, ',');
+        for (size_t a = 0; a < names.size(); ++a) {
+            std::string name = trim(names[a]);
+            spec.names.push_back(name);
+            if (name == "count") {
+                spec.fns.push_back(count_fn);
+                spec.fn_paths.push_back(0);
+                continue;
+            }
+
+            size_t open = name.find('(');
+            if (open == std::string::npos || name[name.size() - 1] != ')') {
+                error(name);
+            }
+            std::string fn = name.substr(0, open);
+            if (fn == "sum") spec.fns.push_back(sum_fn);
+            else if (fn == "min") spec.fns.push_back(min_fn);
+            else if (fn == "max") spec.fns.push_back(max_fn);
+            else if (fn == "avg") spec.fns.push_back(avg_fn);
+            else error(name);
+
+            json::path::path_list_t fn_path = json::path::parse(name.substr(open + 1, name.size() - open - 2));
+            if (fn_path.size() != 1) {
+                error(name);
+            }
+            spec.fn_paths.push_back(paths.size());
+            paths.push_back(fn_path[0]);
+        }
+
+        spec.trie = json::path::path_trie(paths);
+        return spec;
+    }
+}
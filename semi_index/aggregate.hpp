@@ -0,0 +1,258 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <limits>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <boost/unordered_map.hpp>
+
+#include "path_parser.hpp"
+#include "value_decoder.hpp"
+
+namespace semi_index {
+
+    enum aggregate_fn {
+        count_fn,
+        sum_fn,
+        min_fn,
+        max_fn,
+        avg_fn
+    };
+
+    // Group-by paths and aggregates of an aggregation. The paths of
+    // both are resolved together with a single trie: the group-by paths
+    // come first, then the paths of the aggregates
+    struct aggregate_spec {
+        std::vector<std::string> group_names;
+        std::vector<std::string> names; // of the aggregates, as written
+        std::vector<aggregate_fn> fns;
+        std::vector<size_t> fn_paths; // path id of each aggregate, unused for count
+        json::path::path_trie trie;
+    };
+
+    // group_by is a list of paths, as in json::path::parse, which must
+    // be single-valued. aggregates is a list of count, sum(path),
+    // min(path), max(path) and avg(path). The paths of sum, min, max and
+    // avg can be multi-valued, all their matches are accumulated.
+    // Throws std::invalid_argument on syntax errors
+    aggregate_spec parse_aggregate_spec(std::string const& group_by, std::string const& aggregates);
+
+    // Statistics of the numeric values of an aggregate path in a group;
+    // the other values are ignored
+    struct numeric_stats {
+        numeric_stats()
+            : n(0)
+            , sum(0)
+            , min(std::numeric_limits<double>::infinity())
+            , max(-std::numeric_limits<double>::infinity())
+        {}
+
+        void add(double x) {
+            ++n;
+            sum += x;
+            min = std::min(min, x);
+            max = std::max(max, x);
+        }
+
+        void merge(numeric_stats const& other) {
+            n += other.n;
+            sum += other.sum;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+
+        uint64_t n;
+        double sum;
+        double min;
+        double max;
+    };
+
+    namespace detail {
+
+        // Integers are printed as such, so that counts and sums of
+        // integers look like the input
+        inline void append_number(std::string& out, double x) {
+            char buf[32];
+            if (x == double(int64_t(x)) && x > -9007199254740992.0 && x < 9007199254740992.0) {
+                snprintf(buf, sizeof(buf), "%lld", (long long)x);
+            } else {
+                // shortest of the two that reads back as x
+                snprintf(buf, sizeof(buf), "%.15g", x);
+                if (strtod(buf, 0) != x) {
+                    snprintf(buf, sizeof(buf), "%.17g", x);
+                }
+            }
+            out += buf;
+        }
+
+        inline void append_json_string(std::string& out, std::string const& s) {
+            out += '"';
+            for (size_t i = 0; i < s.size(); ++i) {
+                if (s[i] == '"' || s[i] == '\\') out += '\\';
+                out += s[i];
+            }
+            out += '"';
+        }
+    }
+
+    // Hash group-by over a collection, fed one document at a time.
+    // Groups are keyed by the raw bytes of their group-by values, so
+    // that no value is decoded to be hashed; numbers are accumulated
+    // with parse_number. Each thread aggregates its documents in its own
+    // aggregator, and the partial aggregates are merged at the end
+    template <typename Accessor>
+    class aggregator {
+    public:
+        explicit aggregator(aggregate_spec const& spec)
+            : m_spec(spec)
+        {}
+
+        // Adds the document at root, whose text starts at line
+        template <typename Iterator>
+        void add(Accessor const& root, Iterator line) {
+            root.get_paths(m_spec.trie, m_values, m_matches);
+
+            m_key.clear();
+            for (size_t g = 0; g < m_spec.group_names.size(); ++g) {
+                append_raw(m_key, m_values[g], line);
+            }
+            group& grp = find_group(m_key);
+            ++grp.count;
+
+            // matches are grouped by path
+            size_t m = 0;
+            for (size_t a = 0; a < m_spec.fns.size(); ++a) {
+                if (m_spec.fns[a] == count_fn) continue;
+                size_t p = m_spec.fn_paths[a];
+                if (!m_spec.trie.multi_valued[p]) {
+                    add_value(grp.stats[a], m_values[p]);
+                    continue;
+                }
+                while (m < m_matches.size() && m_matches[m].first < p) ++m;
+                for (size_t i = m; i < m_matches.size() && m_matches[i].first == p; ++i) {
+                    add_value(grp.stats[a], m_matches[i].second);
+                }
+            }
+        }
+
+        void merge(aggregator const& other) {
+            for (size_t i = 0; i < other.m_groups.size(); ++i) {
+                group const& src = other.m_groups[i];
+                group& dst = find_group(src.key);
+                dst.count += src.count;
+                for (size_t a = 0; a < dst.stats.size(); ++a) {
+                    dst.stats[a].merge(src.stats[a]);
+                }
+            }
+        }
+
+        size_t num_groups() const {
+            return m_groups.size();
+        }
+
+        // One JSON object per line for each group, with the group-by
+        // values as they are written in the documents. Groups are sorted
+        // by key, so that the output does not depend on how the
+        // documents were split among threads. Statistics of paths
+        // without numeric values are null
+        void write(std::string& out) const {
+            std::vector<std::pair<std::string, size_t> > order;
+            for (size_t i = 0; i < m_groups.size(); ++i) {
+                order.push_back(std::make_pair(m_groups[i].key, i));
+            }
+            std::sort(order.begin(), order.end());
+
+            for (size_t i = 0; i < order.size(); ++i) {
+                group const& grp = m_groups[order[i].second];
+                out += '{';
+                size_t pos = 0;
+                for (size_t g = 0; g < m_spec.group_names.size(); ++g) {
+                    size_t end = grp.key.find('\0', pos);
+                    detail::append_json_string(out, m_spec.group_names[g]);
+                    out += ": ";
+                    out.append(grp.key, pos, end - pos);
+                    pos = end + 1;
+                    out += ", ";
+                }
+                for (size_t a = 0; a < m_spec.fns.size(); ++a) {
+                    if (a) out += ", ";
+                    detail::append_json_string(out, m_spec.names[a]);
+                    out += ": ";
+                    numeric_stats const& stats = grp.stats[a];
+                    if (m_spec.fns[a] == count_fn) {
+                        detail::append_number(out, double(grp.count));
+                    } else if (!stats.n) {
+                        out += "null";
+                    } else if (m_spec.fns[a] == sum_fn) {
+                        detail::append_number(out, stats.sum);
+                    } else if (m_spec.fns[a] == min_fn) {
+                        detail::append_number(out, stats.min);
+                    } else if (m_spec.fns[a] == max_fn) {
+                        detail::append_number(out, stats.max);
+                    } else {
+                        detail::append_number(out, stats.sum / stats.n);
+                    }
+                }
+                out += "}\n";
+            }
+        }
+
+    private:
+        struct group {
+            std::string key;
+            uint64_t count;
+            std::vector<numeric_stats> stats; // one per aggregate
+        };
+
+        group& find_group(std::string const& key) {
+            boost::unordered_map<std::string, size_t>::const_iterator it = m_group_ids.find(key);
+            if (it != m_group_ids.end()) {
+                return m_groups[it->second];
+            }
+            m_group_ids[key] = m_groups.size();
+            m_groups.push_back(group());
+            group& grp = m_groups.back();
+            grp.key = key;
+            grp.count = 0;
+            grp.stats.resize(m_spec.fns.size());
+            return grp;
+        }
+
+        // Appends the text of the value, null if missing, and a NUL as
+        // separator, as JSON text cannot contain NULs
+        template <typename Iterator>
+        static void append_raw(std::string& key, Accessor const& value, Iterator line) {
+            size_t begin = 0, end = 0;
+            if (value.is_valid) {
+                typename Accessor::range_t r = value.get_range();
+                begin = detail::skip_space(line, r.first, r.second);
+                end = detail::trim_space(line, begin, r.second);
+            }
+            if (begin == end) {
+                key += "null";
+            } else {
+                using detail::append_text;
+                append_text(key, line + begin, line + end);
+            }
+            key += '\0';
+        }
+
+        static void add_value(numeric_stats& stats, Accessor const& value) {
+            if (value.type() == number_type) {
+                stats.add(value.as_double());
+            }
+        }
+
+        aggregate_spec const& m_spec;
+        std::vector<group> m_groups;
+        boost::unordered_map<std::string, size_t> m_group_ids;
+
+        // scratch space
+        std::vector<Accessor> m_values;
+        std::vector<std::pair<size_t, Accessor> > m_matches;
+        std::string m_key;
+    };
+}
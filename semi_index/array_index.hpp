@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+
+#include "succinct/bp_vector.hpp"
+#include "succinct/mappable_vector.hpp"
+
+namespace semi_index {
+
+    // Sidecar of the containers with many children: for each of them the
+    // number of children and the node of every sample_rate-th child, so
+    // that the i-th child is reached with at most sample_rate - 1
+    // find_close hops instead of i. The containers are found on the bp
+    // alone, so objects with many members are sampled too
+    class array_index {
+    public:
+        static const uint64_t min_children = 128;
+        static const uint64_t sample_rate = 32;
+
+        array_index() {}
+
+        explicit array_index(succinct::bp_vector const& bp)
+        {
+            // count the children of the open nodes with a stack; nodes
+            // are closed in post-order, so they are sorted afterwards
+            std::vector<std::pair<uint64_t, uint64_t> > stack; // (node, children)
+            std::vector<std::pair<uint64_t, uint64_t> > large;
+            for (uint64_t i = 0; i < bp.size(); ++i) {
+                if (bp[i]) {
+                    if (!stack.empty()) {
+                        ++stack.back().second;
+                    }
+                    stack.push_back(std::make_pair(i, uint64_t(0)));
+                } else {
+                    if (stack.back().second >= min_children) {
+                        large.push_back(stack.back());
+                    }
+                    stack.pop_back();
+                }
+            }
+            std::sort(large.begin(), large.end());
+
+            std::vector<uint64_t> nodes, sizes, offsets, samples;
+            for (size_t a = 0; a < large.size(); ++a) {
+                nodes.push_back(large[a].first);
+                sizes.push_back(large[a].second);
+                offsets.push_back(samples.size());
+                uint64_t child = large[a].first + 1;
+                for (uint64_t c = 0; c < large[a].second; ++c) {
+                    if (c % sample_rate == 0) {
+                        samples.push_back(child);
+                    }
+                    child = bp.find_close(child) + 1;
+                }
+            }
+            m_nodes.steal(nodes);
+            m_sizes.steal(sizes);
+            m_offsets.steal(offsets);
+            m_samples.steal(samples);
+        }
+
+        template <typename Visitor>
+        void map(Visitor& visit) {
+            visit
+                (m_nodes, "m_nodes")
+                (m_sizes, "m_sizes")
+                (m_offsets, "m_offsets")
+                (m_samples, "m_samples")
+                ;
+        }
+
+        void swap(array_index& other) {
+            m_nodes.swap(other.m_nodes);
+            m_sizes.swap(other.m_sizes);
+            m_offsets.swap(other.m_offsets);
+            m_samples.swap(other.m_samples);
+        }
+
+        bool empty() const {
+            return m_nodes.size() == 0;
+        }
+
+        size_t num_containers() const {
+            return m_nodes.size();
+        }
+
+        // Id of the sampled container opened at node, false if the
+        // container is not sampled
+        bool find(uint64_t node, size_t& id) const {
+            const uint64_t* it = std::lower_bound(m_nodes.begin(), m_nodes.end(), node);
+            if (it == m_nodes.end() || *it != node) {
+                return false;
+            }
+            id = it - m_nodes.begin();
+            return true;
+        }
+
+        uint64_t num_children(size_t id) const {
+            return m_sizes[id];
+        }
+
+        // Node of the closest sampled child at or before the i-th child,
+        // with the number of hops left to reach it
+        uint64_t sample(size_t id, uint64_t i, uint64_t& hops) const {
+            hops = i % sample_rate;
+            return m_samples[m_offsets[id] + i / sample_rate];
+        }
+
+    private:
+        succinct::mapper::mappable_vector<uint64_t> m_nodes;
+        succinct::mapper::mappable_vector<uint64_t> m_sizes;
+        succinct::mapper::mappable_vector<uint64_t> m_offsets;
+        succinct::mapper::mappable_vector<uint64_t> m_samples;
+    };
+}
@@ -0,0 +1,232 @@
+#include "json_arena.hpp"
+#include "json_scanner.hpp"
+#include "value_decoder.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+namespace json {
+namespace parser {
+
+    arena::arena(size_t block_size)
+        : m_block_size(block_size)
+        , m_next_block(0)
+        , m_ptr(0)
+        , m_end(0)
+    {}
+
+    arena::~arena()
+    {
+        for (size_t i = 0; i < m_blocks.size(); ++i) {
+            delete [] m_blocks[i].first;
+        }
+    }
+
+    void arena::reset()
+    {
+        m_next_block = 0;
+        m_ptr = m_end = 0;
+    }
+
+    void arena::next_block(size_t size)
+    {
+        // blocks too small for size are skipped until the next reset
+        while (m_next_block < m_blocks.size()) {
+            std::pair<char*, size_t> const& block = m_blocks[m_next_block++];
+            if (block.second >= size) {
+                m_ptr = block.first;
+                m_end = block.first + block.second;
+                return;
+            }
+        }
+        size_t block_size = std::max(m_block_size, size);
+        m_blocks.push_back(std::make_pair(new char[block_size], block_size));
+        m_next_block = m_blocks.size();
+        m_ptr = m_blocks.back().first;
+        m_end = m_ptr + block_size;
+    }
+
+    const arena_value* arena_value::find(std::string const& key) const
+    {
+        for (size_t i = 0; i < size; ++i) {
+            if (members[i].key_size == key.size() &&
+                std::equal(key.begin(), key.end(), members[i].key)) {
+                return &members[i].value;
+            }
+        }
+        return 0;
+    }
+
+    // Recursive descent parser; the children of the containers being
+    // parsed are accumulated in the arena stacks and copied to the arena
+    // when the container is closed
+    class arena_parser {
+    public:
+        arena_parser(const char* first, const char* last, arena& a)
+            : m_cur(first)
+            , m_last(last)
+            , m_arena(a)
+        {
+            // the stacks may be left non-empty by a failed parse
+            m_arena.m_values_stack.clear();
+            m_arena.m_members_stack.clear();
+        }
+
+        bool parse(arena_value& val) {
+            return parse_value(val) && (skip_space(), m_cur == m_last);
+        }
+
+    private:
+        void skip_space() {
+            while (m_cur != m_last && semi_index::detail::is_json_space(*m_cur)) ++m_cur;
+        }
+
+        bool parse_value(arena_value& val) {
+            skip_space();
+            if (m_cur == m_last) return false;
+            switch (*m_cur) {
+            case '{':
+                return parse_object(val);
+            case '[':
+                return parse_array(val);
+            case '"':
+                val.kind = arena_value::string_kind;
+                return parse_string(val.str, val.size);
+            case 't':
+                val.kind = arena_value::bool_kind;
+                val.boolean = true;
+                return parse_literal("true");
+            case 'f':
+                val.kind = arena_value::bool_kind;
+                val.boolean = false;
+                return parse_literal("false");
+            case 'n':
+                val.kind = arena_value::null_kind;
+                return parse_literal("null");
+            default:
+                val.kind = arena_value::number_kind;
+                return parse_number(val.number);
+            }
+        }
+
+        bool parse_literal(const char* literal) {
+            size_t len = strlen(literal);
+            if (size_t(m_last - m_cur) < len || memcmp(m_cur, literal, len)) return false;
+            m_cur += len;
+            return true;
+        }
+
+        bool parse_number(double& number) {
+            const char* end = semi_index::detail::parse_number(m_cur, m_last, number);
+            if (!end) return false;
+            m_cur = end;
+            return true;
+        }
+
+        // m_cur is on the opening quote
+        bool parse_string(const char*& str, size_t& size) {
+            const char* begin = ++m_cur;
+            const char* p = begin;
+            bool escaped = false;
+            while (true) {
+                p = semi_index::detail::find_quote_or_backslash(p, m_last);
+                if (p == m_last) return false;
+                if (*p == '"') break;
+                escaped = true;
+                if (m_last - p < 2) return false;
+                p += 2; // skip the escaped character
+            }
+            m_cur = p + 1;
+
+            if (!escaped) {
+                str = begin;
+                size = p - begin;
+                return true;
+            }
+            char* out = (char*)m_arena.allocate(p - begin);
+            try {
+                size = semi_index::detail::unescape_to(begin, 0, p - begin, out);
+            } catch (std::invalid_argument const&) {
+                return false;
+            }
+            str = out;
+            return true;
+        }
+
+        bool parse_array(arena_value& val) {
+            ++m_cur;
+            std::vector<arena_value>& stack = m_arena.m_values_stack;
+            size_t stack_begin = stack.size();
+            skip_space();
+            if (m_cur != m_last && *m_cur == ']') {
+                ++m_cur;
+            } else {
+                while (true) {
+                    arena_value element;
+                    if (!parse_value(element)) return false;
+                    stack.push_back(element);
+                    skip_space();
+                    if (m_cur == m_last) return false;
+                    char c = *m_cur++;
+                    if (c == ']') break;
+                    if (c != ',') return false;
+                }
+            }
+            val.kind = arena_value::array_kind;
+            val.size = stack.size() - stack_begin;
+            arena_value* elements = (arena_value*)m_arena.allocate(val.size * sizeof(arena_value));
+            std::copy(stack.begin() + stack_begin, stack.end(), elements);
+            stack.resize(stack_begin);
+            val.elements = elements;
+            return true;
+        }
+
+        bool parse_object(arena_value& val) {
+            ++m_cur;
+            std::vector<arena_member>& stack = m_arena.m_members_stack;
+            size_t stack_begin = stack.size();
+            skip_space();
+            if (m_cur != m_last && *m_cur == '}') {
+                ++m_cur;
+            } else {
+                while (true) {
+                    arena_member member;
+                    skip_space();
+                    if (m_cur == m_last || *m_cur != '"') return false;
+                    if (!parse_string(member.key, member.key_size)) return false;
+                    skip_space();
+                    if (m_cur == m_last || *m_cur++ != ':') return false;
+                    if (!parse_value(member.value)) return false;
+                    stack.push_back(member);
+                    skip_space();
+                    if (m_cur == m_last) return false;
+                    char c = *m_cur++;
+                    if (c == '}') break;
+                    if (c != ',') return false;
+                }
+            }
+            val.kind = arena_value::object_kind;
+            val.size = stack.size() - stack_begin;
+            arena_member* members = (arena_member*)m_arena.allocate(val.size * sizeof(arena_member));
+            std::copy(stack.begin() + stack_begin, stack.end(), members);
+            stack.resize(stack_begin);
+            val.members = members;
+            return true;
+        }
+
+        const char* m_cur;
+        const char* m_last;
+        arena& m_arena;
+    };
+
+    const arena_value* parse(const char* first, const char* last, arena& a)
+    {
+        arena_parser parser(first, last, a);
+        arena_value* val = (arena_value*)a.allocate(sizeof(arena_value));
+        if (!parser.parse(*val)) {
+            return 0;
+        }
+        return val;
+    }
+}
+}
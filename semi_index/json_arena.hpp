@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+namespace json {
+namespace parser {
+
+    struct arena_value;
+    struct arena_member;
+
+    // Bump allocator for the arena DOM. Memory is taken from blocks that
+    // are kept by reset(), so that parsing a sequence of documents with
+    // a reset between them stops allocating once the blocks are large
+    // enough. The scratch stacks used by the parser are kept here for
+    // the same reason
+    class arena : boost::noncopyable {
+    public:
+        explicit arena(size_t block_size = 1 << 16);
+        ~arena();
+
+        // 8-byte aligned
+        void* allocate(size_t size)
+        {
+            size = (size + 7) & ~size_t(7);
+            if (size_t(m_end - m_ptr) < size) {
+                next_block(size);
+            }
+            char* ret = m_ptr;
+            m_ptr += size;
+            return ret;
+        }
+
+        // Invalidates all the values allocated so far
+        void reset();
+
+        size_t num_blocks() const {
+            return m_blocks.size();
+        }
+
+        friend class arena_parser;
+
+    private:
+        void next_block(size_t size);
+
+        size_t m_block_size;
+        std::vector<std::pair<char*, size_t> > m_blocks;
+        size_t m_next_block;
+        char* m_ptr;
+        char* m_end;
+
+        std::vector<arena_value> m_values_stack;
+        std::vector<arena_member> m_members_stack;
+    };
+
+    // DOM node allocated in an arena. Arrays and objects point to
+    // contiguous runs of elements and members; strings point into the
+    // parsed text when they have no escapes, into the arena otherwise
+    struct arena_value {
+        enum kind_t {
+            null_kind,
+            bool_kind,
+            number_kind,
+            string_kind,
+            array_kind,
+            object_kind
+        };
+
+        kind_t kind;
+        size_t size; // string length, number of elements or members
+        union {
+            bool boolean;
+            double number;
+            const char* str;
+            const arena_value* elements;
+            const arena_member* members;
+        };
+
+        std::string to_string() const {
+            return std::string(str, size);
+        }
+
+        // Member with the given key, 0 if missing. Linear in the number
+        // of members
+        const arena_value* find(std::string const& key) const;
+    };
+
+    struct arena_member {
+        const char* key;
+        size_t key_size;
+        arena_value value;
+    };
+
+    // Parses [first, last), which must outlive the result, allocating
+    // the DOM in a. Returns 0 on syntax errors
+    const arena_value* parse(const char* first, const char* last, arena& a);
+}
+}
@@ -0,0 +1,162 @@
+#include "json_spirit_parser.hpp"
+#include "json_scanner.hpp"
+#include "value_decoder.hpp"
+
+#include <cstring>
+
+namespace json {
+namespace parser {
+
+    namespace {
+
+        using semi_index::detail::is_json_space;
+
+        // Recursive descent parser building json::parser::value. String
+        // bodies are skipped 16 bytes at a time looking for quotes and
+        // backslashes, and numbers go through parse_number's exact fast
+        // path
+        class value_parser {
+        public:
+            value_parser(const char* first, const char* last)
+                : m_cur(first)
+                , m_last(last)
+            {}
+
+            bool parse(value& val) {
+                return parse_value(val);
+            }
+
+        private:
+            void skip_space() {
+                while (m_cur != m_last && is_json_space(*m_cur)) ++m_cur;
+            }
+
+            bool parse_value(value& val) {
+                skip_space();
+                if (m_cur == m_last) return false;
+                switch (*m_cur) {
+                case '{':
+                    return parse_object(val);
+                case '[':
+                    return parse_array(val);
+                case '"': {
+                    val = std::string();
+                    return parse_string(boost::get<std::string>(val));
+                }
+                case 't':
+                    val = true;
+                    return parse_literal("true");
+                case 'f':
+                    val = false;
+                    return parse_literal("false");
+                case 'n':
+                    val = null_value();
+                    return parse_literal("null");
+                default: {
+                    double number;
+                    const char* end = semi_index::detail::parse_number(m_cur, m_last, number);
+                    if (!end) return false;
+                    m_cur = end;
+                    val = number;
+                    return true;
+                }
+                }
+            }
+
+            bool parse_literal(const char* literal) {
+                size_t len = strlen(literal);
+                if (size_t(m_last - m_cur) < len || memcmp(m_cur, literal, len)) return false;
+                m_cur += len;
+                return true;
+            }
+
+            // m_cur is on the opening quote
+            bool parse_string(std::string& out) {
+                const char* begin = ++m_cur;
+                const char* p = begin;
+                bool escaped = false;
+                while (true) {
+                    p = semi_index::detail::find_quote_or_backslash(p, m_last);
+                    if (p == m_last) return false;
+                    if (*p == '"') break;
+                    escaped = true;
+                    if (m_last - p < 2) return false;
+                    p += 2; // skip the escaped character
+                }
+                m_cur = p + 1;
+
+                if (!escaped) {
+                    out.assign(begin, p);
+                    return true;
+                }
+                try {
+                    semi_index::detail::unescape(begin, 0, p - begin, out);
+                } catch (std::invalid_argument const&) {
+                    return false;
+                }
+                return true;
+            }
+
+            bool parse_array(value& val) {
+                ++m_cur;
+                val = array();
+                array& arr = boost::get<array>(val);
+                skip_space();
+                if (m_cur != m_last && *m_cur == ']') {
+                    ++m_cur;
+                    return true;
+                }
+                while (true) {
+                    arr.push_back(new value());
+                    if (!parse_value(arr.back())) return false;
+                    skip_space();
+                    if (m_cur == m_last) return false;
+                    char c = *m_cur++;
+                    if (c == ']') return true;
+                    if (c != ',') return false;
+                }
+            }
+
+            bool parse_object(value& val) {
+                ++m_cur;
+                val = object();
+                object& obj = boost::get<object>(val);
+                skip_space();
+                if (m_cur != m_last && *m_cur == '}') {
+                    ++m_cur;
+                    return true;
+                }
+                std::string key;
+                while (true) {
+                    skip_space();
+                    if (m_cur == m_last || *m_cur != '"') return false;
+                    if (!parse_string(key)) return false;
+                    skip_space();
+                    if (m_cur == m_last || *m_cur++ != ':') return false;
+                    // the last of duplicate keys wins, as in the Spirit grammar
+                    if (!parse_value(obj[key])) return false;
+                    skip_space();
+                    if (m_cur == m_last) return false;
+                    char c = *m_cur++;
+                    if (c == '}') return true;
+                    if (c != ',') return false;
+                }
+            }
+
+            const char* m_cur;
+            const char* m_last;
+        };
+    }
+
+    bool parse(std::string const& s, value& val)
+    {
+        const char* first = s.data();
+        return parse(first, first + s.size(), val);
+    }
+
+    bool parse(const char* first, const char* last, value& val)
+    {
+        return value_parser(first, last).parse(val);
+    }
+}
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+
+#include "succinct/broadword.hpp"
+
+namespace semi_index {
+
+    // The scanners append to nav one bit per input byte (1 on the
+    // structural characters {}[]:, outside of string literals) and to bp
+    // two parentheses per structural character. Both NavBuilder and
+    // BpBuilder must provide push_back(bit), append_bits(bits, len) and
+    // zero_extend(n), as succinct::bit_vector_builder does.
+
+    namespace detail {
+
+        // bp bits appended for each structural character, LSB first:
+        // "((" for openers, "))" for closers, ")(" for separators
+        inline uint64_t bp_pattern(char c) {
+            switch (c) {
+            case '[':
+            case '{':
+                return 3;
+            case ']':
+            case '}':
+                return 0;
+            default:
+                return 2;
+            }
+        }
+
+        // Bitmasks of the 64 bytes starting at block, bit i corresponds
+        // to block[i]
+        inline void classify_block(const char* block, uint64_t& quote, uint64_t& backslash, uint64_t& structural)
+        {
+#if defined(__AVX2__)
+            quote = backslash = structural = 0;
+            for (size_t i = 0; i < 64; i += 32) {
+                __m256i chunk = _mm256_loadu_si256((const __m256i*)(block + i));
+                // '[' | 0x20 == '{' and ']' | 0x20 == '}'
+                __m256i lowered = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+                __m256i s = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(lowered, _mm256_set1_epi8('{')),
+                                    _mm256_cmpeq_epi8(lowered, _mm256_set1_epi8('}'))),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(',')),
+                                    _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(':'))));
+                __m256i q = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"'));
+                __m256i b = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\'));
+                structural |= uint64_t(uint32_t(_mm256_movemask_epi8(s))) << i;
+                quote |= uint64_t(uint32_t(_mm256_movemask_epi8(q))) << i;
+                backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(b))) << i;
+            }
+#elif defined(__SSE2__)
+            quote = backslash = structural = 0;
+            for (size_t i = 0; i < 64; i += 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)(block + i));
+                __m128i lowered = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+                __m128i s = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(lowered, _mm_set1_epi8('{')),
+                                 _mm_cmpeq_epi8(lowered, _mm_set1_epi8('}'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')),
+                                 _mm_cmpeq_epi8(chunk, _mm_set1_epi8(':'))));
+                __m128i q = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'));
+                __m128i b = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'));
+                structural |= uint64_t(uint16_t(_mm_movemask_epi8(s))) << i;
+                quote |= uint64_t(uint16_t(_mm_movemask_epi8(q))) << i;
+                backslash |= uint64_t(uint16_t(_mm_movemask_epi8(b))) << i;
+            }
+#else
+            quote = backslash = structural = 0;
+            for (size_t i = 0; i < 64; ++i) {
+                char c = block[i];
+                uint64_t bit = uint64_t(1) << i;
+                switch (c) {
+                case '[': case '{': case ']': case '}': case ',': case ':':
+                    structural |= bit;
+                    break;
+                case '"':
+                    quote |= bit;
+                    break;
+                case '\\':
+                    backslash |= bit;
+                    break;
+                }
+            }
+#endif
+        }
+
+        // Characters escaped by an odd-length run of backslashes;
+        // prev_escaped carries a pending escape into the next block
+        inline uint64_t escaped_mask(uint64_t backslash, uint64_t& prev_escaped)
+        {
+            static const uint64_t even_bits = 0x5555555555555555ULL;
+            backslash &= ~prev_escaped;
+            uint64_t follows_escape = (backslash << 1) | prev_escaped;
+            uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+            uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+            prev_escaped = (sequences_starting_on_even_bits < backslash) ? 1 : 0;
+            uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+            return (even_bits ^ invert_mask) & follows_escape;
+        }
+
+        // First '"' or '\\' in [first, last), last if none; used to skip
+        // over the bodies of string literals
+        inline const char* find_quote_or_backslash(const char* first, const char* last)
+        {
+#if defined(__SSE2__)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            for (; last - first >= 16; first += 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)first);
+                int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                          _mm_cmpeq_epi8(chunk, backslash)));
+                if (mask) {
+                    unsigned long bit;
+                    succinct::broadword::lsb(uint64_t(mask), bit);
+                    return first + bit;
+                }
+            }
+#endif
+            for (; first != last; ++first) {
+                if (*first == '"' || *first == '\\') break;
+            }
+            return first;
+        }
+
+        // Bit i of the result is the parity of bits 0..i of x
+        inline uint64_t prefix_xor(uint64_t x)
+        {
+#if defined(__PCLMUL__)
+            __m128i all_ones = _mm_set1_epi8(char(0xFF));
+            __m128i prod = _mm_clmulepi64_si128(_mm_set_epi64x(0, (int64_t)x), all_ones, 0);
+            return (uint64_t)_mm_cvtsi128_si64(prod);
+#else
+            x ^= x << 1;
+            x ^= x << 2;
+            x ^= x << 4;
+            x ^= x << 8;
+            x ^= x << 16;
+            x ^= x << 32;
+            return x;
+#endif
+        }
+    }
+
+    // Byte-at-a-time scanner, works with any forward iterator
+    template <typename Iterator, typename NavBuilder, typename BpBuilder>
+    void scan_json_scalar(Iterator json, Iterator json_end, NavBuilder& nav, BpBuilder& bp)
+    {
+        bool escaped = false;
+        Iterator first;
+
+        for(; json != json_end; ++json) {
+            char c = *json;
+            switch (c) {
+            case '[':
+            case '{':
+                nav.push_back(1);
+                bp.push_back(1);
+                bp.push_back(1);
+                break;
+
+            case '}':
+            case ']':
+                nav.push_back(1);
+                bp.push_back(0);
+                bp.push_back(0);
+                break;
+
+            case ',':
+            case ':':
+                nav.push_back(1);
+                bp.push_back(0);
+                bp.push_back(1);
+                break;
+
+            case '"':
+                // string literal
+                first = json++;
+                while (true) {
+                    if (json == json_end) {
+                        throw std::invalid_argument("Unterminated string literal");
+                    }
+                    if (escaped) {
+                        escaped = false;
+                    } else {
+                        if (*json == '"') {
+                            break;
+                        }
+                        escaped = (*json == '\\');
+                    }
+                    ++json;
+                }
+                nav.zero_extend(std::distance(first, json) + 1);
+                break;
+            default:
+                nav.push_back(0);
+            }
+        }
+    }
+
+    // Scans 64-byte blocks at a time: quotes escaped by odd backslash
+    // runs are discarded, the string mask is the prefix-XOR of the
+    // remaining quotes, and the structural characters inside strings are
+    // masked out. The last partial block is padded with spaces.
+    template <typename NavBuilder, typename BpBuilder>
+    void scan_json_simd(const char* json, const char* json_end, NavBuilder& nav, BpBuilder& bp)
+    {
+        uint64_t prev_escaped = 0;
+        uint64_t prev_in_string = 0;
+        char tail[64];
+
+        while (json != json_end) {
+            size_t len = 64;
+            const char* block = json;
+            if (size_t(json_end - json) < 64) {
+                len = json_end - json;
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, json, len);
+                block = tail;
+            }
+
+            uint64_t quote, backslash, structural;
+            detail::classify_block(block, quote, backslash, structural);
+
+            quote &= ~detail::escaped_mask(backslash, prev_escaped);
+            uint64_t in_string = detail::prefix_xor(quote) ^ prev_in_string;
+            prev_in_string = uint64_t(int64_t(in_string) >> 63);
+            structural &= ~in_string;
+
+            nav.append_bits(structural, len);
+            unsigned long bit;
+            while (succinct::broadword::lsb(structural, bit)) {
+                bp.append_bits(detail::bp_pattern(block[bit]), 2);
+                structural &= structural - 1;
+            }
+
+            json += len;
+        }
+
+        if (prev_in_string) {
+            throw std::invalid_argument("Unterminated string literal");
+        }
+    }
+
+    // Dispatch: contiguous inputs go through the block scanner, anything
+    // else falls back to the scalar one
+    template <typename Iterator, typename NavBuilder, typename BpBuilder>
+    void scan_json(Iterator json, Iterator json_end, NavBuilder& nav, BpBuilder& bp)
+    {
+        scan_json_scalar(json, json_end, nav, bp);
+    }
+
+    template <typename NavBuilder, typename BpBuilder>
+    void scan_json(const char* json, const char* json_end, NavBuilder& nav, BpBuilder& bp)
+    {
+        scan_json_simd(json, json_end, nav, bp);
+    }
+
+    template <typename NavBuilder, typename BpBuilder>
+    void scan_json(std::string::const_iterator json, std::string::const_iterator json_end, NavBuilder& nav, BpBuilder& bp)
+    {
+        if (json == json_end) return;
+        const char* first = &*json;
+        scan_json_simd(first, first + (json_end - json), nav, bp);
+    }
+}
@@ -1,15 +1,24 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
 #include <boost/range.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 #include <stdint.h>
 
 #include "succinct/bp_vector.hpp"
 #include "succinct/elias_fano.hpp"
 
 #include "json_spirit_parser.hpp"
+#include "json_arena.hpp"
 #include "path_parser.hpp"
 #include "escape_table.hpp"
+#include "json_semi_index_builder.hpp"
+#include "key_index.hpp"
+#include "array_index.hpp"
+#include "value_decoder.hpp"
 
 namespace semi_index {
 
@@ -17,6 +26,51 @@ namespace semi_index {
 
     class json_semi_index_test_gateway;
 
+    // Remembers, for each key of a path trie, the bp offset from the
+    // beginning of the object of the member where the key was last
+    // found. On homogeneous documents the member can then be reached
+    // directly, and the key verified, instead of scanning the object
+    class key_predictor {
+    public:
+        static const uint64_t none = uint64_t(-1);
+
+        explicit key_predictor(json::path::path_trie const& trie)
+            : m_offsets(trie.nodes.size(), uint64_t(none))
+            , m_hits(0)
+            , m_misses(0)
+        {}
+
+        uint64_t prediction(size_t trie_node) const {
+            return m_offsets[trie_node];
+        }
+
+        void hit() {
+            ++m_hits;
+        }
+
+        void miss(size_t trie_node, uint64_t found_offset) {
+            m_offsets[trie_node] = found_offset;
+            ++m_misses;
+        }
+
+        uint64_t hits() const {
+            return m_hits;
+        }
+
+        uint64_t misses() const {
+            return m_misses;
+        }
+
+        double hit_rate() const {
+            return (m_hits + m_misses) ? double(m_hits) / (m_hits + m_misses) : 0;
+        }
+
+    private:
+        std::vector<uint64_t> m_offsets;
+        uint64_t m_hits;
+        uint64_t m_misses;
+    };
+
     template <typename Iterator>
     class json_semi_index_base {
     public:
@@ -26,71 +80,35 @@ namespace semi_index {
 	template <typename StringsRange>
         json_semi_index_base(StringsRange const& jsons) 
         {
-            succinct::bit_vector_builder nav;
-            succinct::bit_vector_builder bp;
-
-	    typedef typename boost::range_const_iterator<StringsRange>::type iter_t;
-	    for (iter_t s = boost::begin(jsons);
-		 s != boost::end(jsons);
-		 ++s) {
-
-		typedef typename boost::range_value<StringsRange>::type::const_iterator iter_t;
-		bool escaped = false;
-		iter_t first;
-		iter_t json = boost::begin(*s);
-		iter_t json_end = boost::end(*s);
-		
-		for(; json != json_end; ++json) {
-		    char c = *json;
-		    switch (c) {
-		    case '[':
-		    case '{':
-			nav.push_back(1);
-			bp.push_back(1);
-			bp.push_back(1);
-			break;
-		    
-		    case '}':
-		    case ']':
-			nav.push_back(1);
-			bp.push_back(0);
-			bp.push_back(0);
-			break;
-
-		    case ',':
-		    case ':':
-			nav.push_back(1);
-			bp.push_back(0);
-			bp.push_back(1);
-			break;
-                
-		    case '"':
-			// string literal
-			first = json++;
-			while (true) {
-			    if (json == json_end) {
-				throw std::invalid_argument("Unterminated string literal");
-			    }
-			    if (escaped) {
-				escaped = false;
-			    } else {
-				if (*json == '"') {
-				    break;
-				}
-				escaped = (*json == '\\');
-			    }
-			    ++json;
-			}
-			nav.zero_extend(json - first + 1);
-			break;
-		    default:
-			nav.push_back(0);
-		    }
-		}
+            json_semi_index_builder builder;
+            builder.append(jsons);
+            json_semi_index_base(&builder).swap(*this);
+        }
+
+        json_semi_index_base(json_semi_index_builder* builder)
+        {
+            builder->nav().build(m_nav);
+            builder->bp().build(m_bp);
+
+            if (builder->document_index()) {
+                // the roots are found by skipping from one to the next,
+                // as cursor::next() does
+                positions_builder docs;
+                for (uint64_t node = 0; node < m_bp.size(); node = m_bp.find_close(node) + 1) {
+                    docs.zero_extend(node - docs.size());
+                    docs.push_back(1);
+                }
+                docs.zero_extend(m_bp.size() - docs.size());
+                docs.build(m_docs);
+            }
+
+            if (builder->key_index()) {
+                key_index(builder->keys()).swap(m_keys);
+            }
+
+            if (builder->array_index()) {
+                array_index(m_bp).swap(m_arrays);
             }
-	    
-            succinct::elias_fano(&nav, false).swap(m_nav);
-            succinct::bp_vector(&bp, false, false).swap(m_bp);
         }
         
         template <typename Visitor>
@@ -98,15 +116,33 @@ namespace semi_index {
             visit
                 (m_nav, "m_nav")
                 (m_bp, "m_bp")
+                (m_docs, "m_docs")
+                (m_keys, "m_keys")
+                (m_arrays, "m_arrays")
                 ;
         }
 
         void swap(json_semi_index_base& other) {
             m_nav.swap(other.m_nav);
             m_bp.swap(other.m_bp);
+            m_docs.swap(other.m_docs);
+            m_keys.swap(other.m_keys);
+            m_arrays.swap(other.m_arrays);
         }
 
 	class cursor;
+	class child_iterator;
+	class member_iterator;
+        class accessor;
+
+        // A value matched by a multi-valued path, with the path id
+        typedef std::pair<size_t, accessor> path_match;
+
+        struct path_match_less {
+            bool operator()(path_match const& a, path_match const& b) const {
+                return a.first < b.first;
+            }
+        };
 
         class accessor {
         public:
@@ -137,7 +173,13 @@ namespace semi_index {
                 return next;
             }
 
+	    // Multi-valued paths return their first match
 	    accessor get_path(path_t const& path) const {
+		if (json::path::is_multi_valued(path)) {
+		    std::vector<accessor> results;
+		    get_paths(json::path::path_trie(json::path::path_list_t(1, path)), results);
+		    return results[0];
+		}
 		accessor next = *this;
 		for (size_t i = 0; i < path.size() && next.is_valid; ++i) {
 		    const std::string* key;
@@ -151,6 +193,71 @@ namespace semi_index {
 		return next;
 	    }
 
+	    // Resolves all the paths of the trie at once: results[i] is set to
+	    // the accessor of the i-th path. Each object on the way is scanned
+	    // once, regardless of how many of its children are requested. If a
+	    // predictor is given, it is used to look up the keys at the
+	    // member where they were found in the previous documents.
+	    // Multi-valued paths get their first match
+	    void get_paths(json::path::path_trie const& trie, std::vector<accessor>& results,
+			   key_predictor* predictor = 0) const {
+		results.assign(trie.num_paths, accessor());
+		if (is_valid) {
+		    m_index->get_trie_children(*this, trie, 0, results, 0, predictor);
+		}
+	    }
+
+	    // Same as above, but all the matches of the multi-valued paths
+	    // are stored in matches, grouped by path id and in document
+	    // order within each path; their entries in results are invalid
+	    void get_paths(json::path::path_trie const& trie, std::vector<accessor>& results,
+			   std::vector<path_match>& matches, key_predictor* predictor = 0) const {
+		results.assign(trie.num_paths, accessor());
+		matches.clear();
+		if (is_valid) {
+		    m_index->get_trie_children(*this, trie, 0, results, &matches, predictor);
+		    std::stable_sort(matches.begin(), matches.end(), path_match_less());
+		}
+	    }
+
+            // Elements of an array, keys and values alternated for an
+            // object, nothing for the other values. Each child is reached
+            // from the previous one with a single find_close
+            std::pair<child_iterator, child_iterator> children() const {
+                char bracket;
+                uint64_t first, last;
+                if (!is_valid || !m_index->get_children(m_json, m_node, m_offset, bracket, first, last)) {
+                    return std::make_pair(child_iterator(), child_iterator());
+                }
+                return std::make_pair(child_iterator(*this, first), child_iterator(*this, last));
+            }
+
+            // (key, value) members of an object, nothing for the other
+            // values
+            std::pair<member_iterator, member_iterator> members() const {
+                char bracket;
+                uint64_t first, last;
+                if (!is_valid || !m_index->get_children(m_json, m_node, m_offset, bracket, first, last) ||
+                    bracket != '{') {
+                    return std::make_pair(member_iterator(), member_iterator());
+                }
+                return std::make_pair(member_iterator(*this, first, last), member_iterator(*this, last, last));
+            }
+
+            // Number of elements of an array or members of an object, 0
+            // for the other values. Counted on the bp: the text is read
+            // only for the opening bracket, and to tell an empty array
+            // from an array with a single element
+            size_t size() const {
+                char bracket;
+                uint64_t first, last;
+                if (!is_valid || !m_index->get_children(m_json, m_node, m_offset, bracket, first, last)) {
+                    return 0;
+                }
+                size_t n = m_index->count_children(first, last);
+                return (bracket == '{') ? n / 2 : n;
+            }
+
             size_t get_pos() const {
                 return m_index->get_pos(m_node, m_offset);
             }
@@ -169,16 +276,110 @@ namespace semi_index {
                     std::terminate();
                 }
                 range_t range = get_range();
-                bool ret = json::parser::parse(m_json + range.first, m_json + range.second, value);
+                std::string buffer;
+                string_view_t text = detail::contiguous_text(m_json, range.first, range.second, buffer);
+                bool ret = json::parser::parse(text.first, text.second, value);
                 if (!ret) {
                     std::terminate();
                 }
                 return value;
             }
-            
+
+            // Parses the value into an arena DOM, whose strings may point
+            // into the JSON text. Resetting the arena between documents
+            // makes the parsing allocation-free once the arena has grown
+            json::parser::arena_value const& parse(json::parser::arena& a) const {
+                if (!is_valid) {
+                    std::terminate();
+                }
+                range_t range = get_range();
+                const json::parser::arena_value* value =
+                    json::parser::parse(m_json + range.first, m_json + range.second, a);
+                if (!value) {
+                    std::terminate();
+                }
+                return *value;
+            }
+
+            // Typed access to the value, decoded in place; the value
+            // type is given by its first character. The as_* methods
+            // throw std::invalid_argument if the value does not have the
+            // requested type
+            value_type type() const {
+                if (!is_valid) {
+                    return invalid_type;
+                }
+                range_t r = value_range();
+                return (r.first == r.second) ? invalid_type : detail::type_of(*(m_json + r.first));
+            }
+
+            bool is_null() const {
+                return type() == null_type;
+            }
+
+            bool as_bool() const {
+                range_t r = value_range();
+                if (detail::match_literal(m_json, r.first, r.second, "true")) {
+                    return true;
+                } else if (detail::match_literal(m_json, r.first, r.second, "false")) {
+                    return false;
+                }
+                throw std::invalid_argument("Not a boolean");
+            }
+
+            // Throws std::out_of_range if the integer does not fit
+            int64_t as_int64() const {
+                range_t r = value_range();
+                return detail::parse_int64(m_json, r.first, r.second);
+            }
+
+            double as_double() const {
+                range_t r = value_range();
+                return detail::parse_double(m_json, r.first, r.second);
+            }
+
+            // Contents of a string, between the quotes, with the escapes
+            // left as they are
+            std::pair<Iterator, Iterator> as_raw_string() const {
+                range_t r = string_range();
+                return std::make_pair(m_json + r.first, m_json + r.second);
+            }
+
+            // Contents of a string with the escapes decoded. If the JSON
+            // is contiguous and the string has no escapes the result
+            // points into the JSON, otherwise the string is decoded in
+            // buffer
+            string_view_t as_unescaped_string(std::string& buffer) const {
+                range_t r = string_range();
+                return detail::unescaped_view(m_json, r.first, r.second, buffer);
+            }
+
             bool is_valid;
             friend class cursor;
+            friend class child_iterator;
+            friend class member_iterator;
+            friend class json_semi_index_base;
         private:
+            // get_range() without the surrounding whitespace
+            range_t value_range() const {
+                if (!is_valid) {
+                    std::terminate();
+                }
+                range_t r = get_range();
+                r.first = detail::skip_space(m_json, r.first, r.second);
+                r.second = detail::trim_space(m_json, r.first, r.second);
+                return r;
+            }
+
+            range_t string_range() const {
+                range_t r = value_range();
+                if (r.second - r.first < 2 ||
+                    *(m_json + r.first) != '"' || *(m_json + (r.second - 1)) != '"') {
+                    throw std::invalid_argument("Not a string");
+                }
+                return range_t(r.first + 1, r.second - 1);
+            }
+
             accessor(Iterator json, const json_semi_index_base* index, uint64_t node, size_t offset) 
                 : is_valid(true)
                 , m_node(node)
@@ -193,6 +394,92 @@ namespace semi_index {
 	    size_t m_offset;
         };
 
+	class child_iterator
+	    : public boost::iterator_facade<child_iterator, accessor,
+					    boost::forward_traversal_tag, accessor> {
+	public:
+	    child_iterator()
+		: m_node(0)
+	    {}
+
+	private:
+	    friend class boost::iterator_core_access;
+	    friend class accessor;
+
+	    child_iterator(accessor const& parent, uint64_t node)
+		: m_parent(parent)
+		, m_node(node)
+	    {}
+
+	    accessor dereference() const {
+		return accessor(m_parent.m_json, m_parent.m_index, m_node, m_parent.m_offset);
+	    }
+
+	    void increment() {
+		m_node = m_parent.m_index->find_close(m_node) + 1;
+	    }
+
+	    bool equal(child_iterator const& other) const {
+		return m_node == other.m_node;
+	    }
+
+	    accessor m_parent;
+	    uint64_t m_node;
+	};
+
+	struct member {
+	    accessor key; // the key string, see as_unescaped_string()
+	    accessor value;
+	};
+
+	class member_iterator
+	    : public boost::iterator_facade<member_iterator, member,
+					    boost::forward_traversal_tag, member> {
+	public:
+	    member_iterator()
+		: m_node(0)
+		, m_value_node(0)
+		, m_end(0)
+	    {}
+
+	private:
+	    friend class boost::iterator_core_access;
+	    friend class accessor;
+
+	    member_iterator(accessor const& parent, uint64_t node, uint64_t end)
+		: m_parent(parent)
+		, m_node(node)
+		, m_end(end)
+	    {
+		find_value();
+	    }
+
+	    void find_value() {
+		m_value_node = (m_node != m_end) ? m_parent.m_index->find_close(m_node) + 1 : 0;
+	    }
+
+	    member dereference() const {
+		member m;
+		m.key = accessor(m_parent.m_json, m_parent.m_index, m_node, m_parent.m_offset);
+		m.value = accessor(m_parent.m_json, m_parent.m_index, m_value_node, m_parent.m_offset);
+		return m;
+	    }
+
+	    void increment() {
+		m_node = m_parent.m_index->find_close(m_value_node) + 1;
+		find_value();
+	    }
+
+	    bool equal(member_iterator const& other) const {
+		return m_node == other.m_node;
+	    }
+
+	    accessor m_parent;
+	    uint64_t m_node;
+	    uint64_t m_value_node;
+	    uint64_t m_end;
+	};
+
 	class cursor {
 	public:
 	    cursor()
@@ -244,6 +531,43 @@ namespace semi_index {
 	    return cursor(this, 0);
 	}
 
+	// Number of documents, 0 if the index was built without the
+	// document index
+	size_t num_documents() const {
+	    return m_docs.num_ones();
+	}
+
+	// Cursor on the doc_id-th document, in constant time
+	cursor get_cursor(size_t doc_id) const {
+	    assert(doc_id < num_documents());
+	    return cursor(this, m_docs.select(doc_id));
+	}
+
+	// Id of the last document that starts at or before offset, found by
+	// binary search on the document positions
+	size_t document_at(size_t offset) const {
+	    assert(num_documents());
+	    size_t lo = 0, hi = num_documents();
+	    while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (get_pos(m_docs.select(mid), 0) <= offset) {
+		    lo = mid;
+		} else {
+		    hi = mid;
+		}
+	    }
+	    return lo;
+	}
+
+	// Whether member keys are matched through the key dictionary
+	bool has_key_index() const {
+	    return !m_keys.empty();
+	}
+
+	bool has_array_index() const {
+	    return !m_arrays.empty();
+	}
+
 	uint64_t tree_size() const {
 	    return m_bp.size();
 	}
@@ -253,18 +577,28 @@ namespace semi_index {
     protected:
         bool get_object_child(Iterator json, uint64_t node, size_t offset, std::string const& key, uint64_t& child_node) const {
             node += node % 2;
-            size_t opening_pos = get_pos(node, offset);
-	    Iterator iter = json + opening_pos;
-            if (*iter != '{') {
-                return false;
-            }
-            if (*++iter == '}') {
-                // Empty objects are a special case ("(())" in BP representation)
-                return false;
+            uint64_t key_id = key_index::not_found;
+            if (has_key_index()) {
+                // A non-empty object's first child is a member; the node
+                // after a scalar can also be a member, of the enclosing
+                // object, so the node must open a container
+                key_id = m_keys.key_id(key);
+                if (key_id == key_index::not_found || !m_bp[node] || !m_keys.is_member(node + 1)) {
+                    return false;
+                }
+            } else {
+                Iterator iter = json + get_pos(node, offset);
+                if (*iter != '{') {
+                    return false;
+                }
+                while (detail::is_json_space(*++iter));
+                if (*iter == '}') {
+                    // Empty objects are a special case ("(())" in BP representation)
+                    return false;
+                }
             }
 
             uint64_t cur_node = node + 1;
-            uint64_t cur_node_pos = opening_pos + 1;
 
             while (true) {
                 if (m_bp[cur_node] == 0) {
@@ -274,17 +608,299 @@ namespace semi_index {
                 uint64_t cur_node_end = m_bp.find_close(cur_node);
                 uint64_t cur_node_val_begin = cur_node_end + 1;
 
-                if (check_key(json, key, cur_node_pos)) {
+                if (check_member_key(json, cur_node, offset, key, key_id)) {
                     child_node = cur_node_val_begin;
                     return true;
                 }
 
                 uint64_t cur_node_val_end = m_bp.find_close(cur_node_val_begin);
                 cur_node = cur_node_val_end + 1;
-                cur_node_pos = get_pos(cur_node, offset) + 1;
             }
         }
 
+        void get_trie_children(accessor const& parent, json::path::path_trie const& trie, size_t trie_node,
+                               std::vector<accessor>& results, std::vector<path_match>* matches,
+                               key_predictor* predictor) const {
+            json::path::path_trie::node const& tn = trie.nodes[trie_node];
+            for (size_t i = 0; i < tn.paths.size(); ++i) {
+                size_t p = tn.paths[i];
+                if (!trie.multi_valued[p]) {
+                    results[p] = parent;
+                } else if (matches) {
+                    matches->push_back(path_match(p, parent));
+                } else if (!results[p].is_valid) {
+                    results[p] = parent;
+                }
+            }
+
+            for (size_t i = 0; i < tn.indices.size(); ++i) {
+                accessor child = parent[tn.indices[i].first];
+                if (child.is_valid) {
+                    get_trie_children(child, trie, tn.indices[i].second, results, matches, predictor);
+                }
+            }
+
+            Iterator json = parent.m_json;
+            size_t offset = parent.m_offset;
+
+            if (!tn.slices.empty() || tn.any_key) {
+                char bracket;
+                uint64_t first, last;
+                if (get_children(json, parent.m_node, offset, bracket, first, last)) {
+                    if (bracket == '[') {
+                        for (size_t i = 0; i < tn.slices.size(); ++i) {
+                            get_slice_children(json, offset, first, last, tn.slices[i].first,
+                                               trie, tn.slices[i].second, results, matches, predictor);
+                        }
+                    } else if (tn.any_key) {
+                        for (uint64_t cur_node = first; cur_node != last; ) {
+                            uint64_t cur_node_val_begin = m_bp.find_close(cur_node) + 1;
+                            get_trie_children(accessor(json, this, cur_node_val_begin, offset),
+                                              trie, tn.any_key, results, matches, predictor);
+                            cur_node = m_bp.find_close(cur_node_val_begin) + 1;
+                        }
+                    }
+                }
+            }
+
+            if (!tn.descendants.empty()) {
+                std::vector<uint64_t> found;
+                for (size_t i = 0; i < tn.descendants.size(); ++i) {
+                    found.clear();
+                    find_descendants(json, parent.m_node, offset, tn.descendants[i].first, found);
+                    for (size_t j = 0; j < found.size(); ++j) {
+                        get_trie_children(accessor(json, this, found[j], offset),
+                                          trie, tn.descendants[i].second, results, matches, predictor);
+                    }
+                }
+            }
+
+            if (tn.keys.empty()) {
+                return;
+            }
+
+            // Same walk as get_object_child, but each member key is checked
+            // against all the requested keys that are still missing
+            uint64_t node = parent.m_node + parent.m_node % 2;
+
+            std::vector<bool> found(tn.keys.size(), false);
+            size_t missing = tn.keys.size();
+            std::vector<uint64_t> key_ids(tn.keys.size(), uint64_t(key_index::not_found));
+            if (has_key_index()) {
+                if (!m_bp[node] || !m_keys.is_member(node + 1)) {
+                    return;
+                }
+                // keys that are not in the dictionary cannot be found
+                for (size_t i = 0; i < tn.keys.size(); ++i) {
+                    key_ids[i] = m_keys.key_id(tn.keys[i].first);
+                    if (key_ids[i] == key_index::not_found) {
+                        found[i] = true;
+                        --missing;
+                    }
+                }
+            } else {
+                Iterator iter = json + get_pos(node, offset);
+                if (*iter != '{') {
+                    return;
+                }
+                while (detail::is_json_space(*++iter));
+                if (*iter == '}') {
+                    return;
+                }
+            }
+
+            uint64_t first_member = node + 1;
+
+            if (predictor) {
+                // A predicted node is a member key of this object if it is
+                // an opening parenthesis inside the object, at the same
+                // depth as the first member, and it opens a member (preceded
+                // by '{' or ',')
+                uint64_t object_end = m_bp.find_close(node);
+                int64_t member_excess = excess(first_member);
+                for (size_t i = 0; i < tn.keys.size(); ++i) {
+                    if (found[i]) continue;
+                    uint64_t predicted = predictor->prediction(tn.keys[i].second);
+                    if (predicted == key_predictor::none) continue;
+                    uint64_t cand = first_member + predicted;
+                    if (cand >= object_end || !m_bp[cand] || excess(cand) != member_excess) continue;
+                    if (is_member(json, cand, offset) &&
+                        check_member_key(json, cand, offset, tn.keys[i].first, key_ids[i])) {
+                        found[i] = true;
+                        --missing;
+                        predictor->hit();
+                        get_trie_children(accessor(json, this, m_bp.find_close(cand) + 1, offset),
+                                          trie, tn.keys[i].second, results, matches, predictor);
+                    }
+                }
+            }
+
+            uint64_t cur_node = first_member;
+
+            while (missing && m_bp[cur_node] != 0) {
+                uint64_t cur_node_val_begin = m_bp.find_close(cur_node) + 1;
+
+                for (size_t i = 0; i < tn.keys.size(); ++i) {
+                    if (!found[i] && check_member_key(json, cur_node, offset, tn.keys[i].first, key_ids[i])) {
+                        found[i] = true;
+                        --missing;
+                        if (predictor) {
+                            predictor->miss(tn.keys[i].second, cur_node - first_member);
+                        }
+                        get_trie_children(accessor(json, this, cur_node_val_begin, offset),
+                                          trie, tn.keys[i].second, results, matches, predictor);
+                        break;
+                    }
+                }
+
+                uint64_t cur_node_val_end = m_bp.find_close(cur_node_val_begin);
+                cur_node = cur_node_val_end + 1;
+            }
+        }
+
+        // Visits the elements of the slice of the array whose children
+        // are [first, last). Only the elements up to the end of the slice
+        // are walked, the array is counted only for negative bounds
+        void get_slice_children(Iterator json, size_t offset, uint64_t first, uint64_t last,
+                                json::path::slice_t const& slice,
+                                json::path::path_trie const& trie, size_t trie_node,
+                                std::vector<accessor>& results, std::vector<path_match>* matches,
+                                key_predictor* predictor) const {
+            int64_t begin = slice.first ? *slice.first : 0;
+            int64_t end = slice.last ? *slice.last : std::numeric_limits<int64_t>::max();
+            if (begin < 0 || end < 0) {
+                int64_t size = count_children(first, last);
+                if (begin < 0) begin = std::max(begin + size, int64_t(0));
+                if (end < 0) end = end + size;
+            }
+            if (begin >= end) {
+                return;
+            }
+
+            int64_t i = begin;
+            for (uint64_t cur_node = skip_children(first, last, begin); cur_node != last && i < end;
+                 cur_node = m_bp.find_close(cur_node) + 1, ++i) {
+                get_trie_children(accessor(json, this, cur_node, offset),
+                                  trie, trie_node, results, matches, predictor);
+            }
+        }
+
+        // Number of children in [first, last), from the array sidecar if
+        // the container is sampled
+        uint64_t count_children(uint64_t first, uint64_t last) const {
+            size_t id;
+            if (first != last && m_arrays.find(first - 1, id)) {
+                return m_arrays.num_children(id);
+            }
+            uint64_t n = 0;
+            for (uint64_t cur_node = first; cur_node != last; cur_node = m_bp.find_close(cur_node) + 1) {
+                ++n;
+            }
+            return n;
+        }
+
+        // Node of the n-th child in [first, last), last if there are
+        // fewer children. Sampled containers are entered at the closest
+        // sample
+        uint64_t skip_children(uint64_t first, uint64_t last, uint64_t n) const {
+            uint64_t cur_node = first;
+            size_t id;
+            if (n && first != last && m_arrays.find(first - 1, id)) {
+                if (n >= m_arrays.num_children(id)) {
+                    return last;
+                }
+                cur_node = m_arrays.sample(id, n, n);
+            }
+            for (; n && cur_node != last; --n) {
+                cur_node = m_bp.find_close(cur_node) + 1;
+            }
+            return cur_node;
+        }
+
+        // Appends to found the value nodes of the members with the given
+        // key in the subtree of node, in document order. With a key
+        // index the packed key ids of the members in the subtree are
+        // scanned, without touching the text or the bp; otherwise the
+        // subtree is walked and the keys are compared
+        void find_descendants(Iterator json, uint64_t node, size_t offset,
+                              std::string const& key, std::vector<uint64_t>& found) const {
+            char bracket;
+            uint64_t first, last;
+            if (!get_children(json, node, offset, bracket, first, last)) {
+                return;
+            }
+
+            if (has_key_index()) {
+                uint64_t key_id = m_keys.key_id(key);
+                if (key_id == key_index::not_found || first == last) {
+                    return;
+                }
+                uint64_t end = m_keys.members_before(last);
+                for (uint64_t i = m_keys.members_before(first); i < end; ++i) {
+                    if (m_keys.member_key_id_at(i) == key_id) {
+                        found.push_back(m_bp.find_close(m_keys.member_node(i)) + 1);
+                    }
+                }
+                return;
+            }
+
+            for (uint64_t cur_node = first; cur_node != last; ) {
+                uint64_t value_node = cur_node;
+                if (bracket == '{') {
+                    value_node = m_bp.find_close(cur_node) + 1;
+                    if (check_key(json, key, get_pos(cur_node, offset))) {
+                        found.push_back(value_node);
+                    }
+                }
+                find_descendants(json, value_node, offset, key, found);
+                cur_node = m_bp.find_close(value_node) + 1;
+            }
+        }
+
+        // Whether the child node of an object opens a member, rather than
+        // a value
+        bool is_member(Iterator json, uint64_t node, size_t offset) const {
+            if (has_key_index()) {
+                return m_keys.is_member(node);
+            }
+            char sep = *(json + (get_pos(node, offset) - 1));
+            return sep == '{' || sep == ',';
+        }
+
+        // Whether the member opened at node has the given key; key_id is
+        // the id of key if the index has a key dictionary
+        bool check_member_key(Iterator json, uint64_t node, size_t offset,
+                              std::string const& key, uint64_t key_id) const {
+            if (has_key_index()) {
+                return m_keys.member_key_id(node) == key_id;
+            }
+            return check_key(json, key, get_pos(node, offset));
+        }
+
+        // Range [first, last) of the children of the container at node,
+        // false if the node is not an array or an object. Empty
+        // containers have the same bp as the ones with a single child,
+        // "(())", so they are told apart by looking at the text
+        bool get_children(Iterator json, uint64_t node, size_t offset,
+                          char& bracket, uint64_t& first, uint64_t& last) const {
+            node += node % 2;
+            size_t pos = get_pos(node, offset);
+            bracket = *(json + pos);
+            if (bracket != '[' && bracket != '{') {
+                return false;
+            }
+            first = node + 1;
+            last = m_bp.find_close(node);
+            if (m_bp.find_close(first) + 1 == last) {
+                size_t end = detail::skip_space(json, pos + 1, get_pos(last - 1, offset));
+                char c = *(json + end);
+                if (c == ']' || c == '}') {
+                    first = last;
+                }
+            }
+            return true;
+        }
+
         bool get_array_child(Iterator json, uint64_t node, size_t offset, int64_t idx, uint64_t& child_node) const {
             node += node % 2;
             size_t opening_pos = get_pos(node, offset);
@@ -293,10 +909,28 @@ namespace semi_index {
             if (*iter != '[') {
                 return false;
             }
-            if (*++iter == ']') {
+            // the closing bracket bounds the whitespace
+            while (detail::is_json_space(*++iter));
+            if (*iter == ']') {
                 // Empty arrays are a special case ("(())" in BP representation)
                 return false;
             }
+
+            size_t id;
+            if (m_arrays.find(node, id)) {
+                int64_t size = m_arrays.num_children(id);
+                int64_t i = (idx >= 0) ? idx : idx + size;
+                if (i < 0 || i >= size) {
+                    return false;
+                }
+                uint64_t hops;
+                uint64_t cur_node = m_arrays.sample(id, i, hops);
+                for (; hops; --hops) {
+                    cur_node = m_bp.find_close(cur_node) + 1;
+                }
+                child_node = cur_node;
+                return true;
+            }
             
             int64_t i = 0;
             uint64_t cur_node;
@@ -342,6 +976,11 @@ namespace semi_index {
             return m_nav.select(closer / 2) + (1 - node % 2) - offset;
 	}
 
+        // Excess (opened minus closed parentheses) before position pos
+        int64_t excess(uint64_t pos) const {
+            return 2 * int64_t(m_bp.rank(pos)) - int64_t(pos);
+        }
+
         uint64_t find_close(uint64_t node) const {
             return m_bp.find_close(node);
         }
@@ -371,6 +1010,9 @@ namespace semi_index {
 
         succinct::elias_fano m_nav;
         succinct::bp_vector m_bp;
+        succinct::elias_fano m_docs; // bp positions of the roots
+        key_index m_keys;
+        array_index m_arrays; // empty unless built with the array index
     };
  
     typedef json_semi_index_base<const char*> json_semi_index;
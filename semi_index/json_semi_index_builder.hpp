@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <boost/range.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "json_scanner.hpp"
+#include "stream_builder.hpp"
+#include "key_index.hpp"
+
+namespace semi_index {
+
+    namespace detail {
+
+        // Scans each newline-terminated line in [first, last) as a
+        // separate document. The newline is part of the line, so that
+        // positions match the ones obtained with succinct::util::lines.
+        // If keys is not null, the member keys are collected as well
+        template <typename NavBuilder, typename BpBuilder>
+        void scan_json_lines(const char* first, const char* last, NavBuilder& nav, BpBuilder& bp,
+                             key_ids_builder* keys = 0)
+        {
+            while (first != last) {
+                const char* eol = (const char*)memchr(first, '\n', last - first);
+                const char* next = eol ? eol + 1 : last;
+                scan_json(first, next, nav, bp);
+                if (keys) {
+                    scan_json_keys(first, next, *keys);
+                }
+                first = next;
+            }
+        }
+
+        struct lines_chunk_builder {
+            lines_chunk_builder(const char* first, const char* last, size_t spill_threshold, bool key_index)
+                : m_first(first)
+                , m_last(last)
+                , m_key_index(key_index)
+            {
+                m_nav.spill_to_disk(spill_threshold);
+                m_bp.spill_to_disk(spill_threshold);
+                m_keys.spill_to_disk(spill_threshold);
+            }
+
+            void operator()() {
+                try {
+                    scan_json_lines(m_first, m_last, m_nav, m_bp, m_key_index ? &m_keys : 0);
+                } catch (std::exception const& e) {
+                    m_error = e.what();
+                }
+            }
+
+            const char* m_first;
+            const char* m_last;
+            bool m_key_index;
+            positions_builder m_nav;
+            bits_builder m_bp;
+            key_ids_builder m_keys;
+            std::string m_error;
+        };
+    }
+
+    // Accumulates the nav and bp bit vectors of a sequence of documents,
+    // which can then be frozen into a json_semi_index_base. nav is kept
+    // as a stream of positions and bp as packed words, both optionally
+    // spilled to disk, so memory usage is proportional to the size of
+    // the index rather than to the size of the input
+    class json_semi_index_builder : boost::noncopyable {
+    public:
+
+        json_semi_index_builder()
+            : m_spill_threshold(0)
+            , m_document_index(true)
+            , m_key_index(false)
+            , m_array_index(false)
+        {}
+
+        // Whether the index stores the positions of the documents, which
+        // enable random access by document id. Enabled by default
+        void document_index(bool enable) {
+            m_document_index = enable;
+        }
+
+        bool document_index() const {
+            return m_document_index;
+        }
+
+        // Whether the index stores the key of each object member as an
+        // id in a key dictionary, so that keys can be matched without
+        // reading the JSON text. Disabled by default; must be set before
+        // appending documents
+        void key_index(bool enable) {
+            m_key_index = enable;
+        }
+
+        bool key_index() const {
+            return m_key_index;
+        }
+
+        // Whether the index samples the children of the arrays (and
+        // objects) with many children, so that indexing them takes a
+        // bounded number of bp operations. Disabled by default
+        void array_index(bool enable) {
+            m_array_index = enable;
+        }
+
+        bool array_index() const {
+            return m_array_index;
+        }
+
+        // Move the intermediate streams to temporary files whenever their
+        // in-memory part exceeds threshold bytes
+        void spill_to_disk(size_t threshold) {
+            m_spill_threshold = threshold;
+            m_nav.spill_to_disk(threshold);
+            m_bp.spill_to_disk(threshold);
+            m_keys.spill_to_disk(threshold);
+        }
+
+        template <typename StringsRange>
+        void append(StringsRange const& jsons)
+        {
+            typedef typename boost::range_const_iterator<StringsRange>::type iter_t;
+            for (iter_t s = boost::begin(jsons);
+                 s != boost::end(jsons);
+                 ++s) {
+                scan_json(boost::begin(*s), boost::end(*s), m_nav, m_bp);
+                if (m_key_index) {
+                    scan_json_keys(boost::begin(*s), boost::end(*s), m_keys);
+                }
+            }
+        }
+
+        // Appends the newline-separated documents in [first, last). The
+        // buffer is split at newline boundaries into one chunk per
+        // thread; the chunks are scanned concurrently and their bit
+        // vectors concatenated in order, so the result is identical to
+        // the serial build
+        void append_lines(const char* first, const char* last, size_t threads = 1)
+        {
+            if (threads <= 1) {
+                detail::scan_json_lines(first, last, m_nav, m_bp, m_key_index ? &m_keys : 0);
+                return;
+            }
+
+            boost::ptr_vector<detail::lines_chunk_builder> chunks;
+            size_t chunk_size = (last - first) / threads + 1;
+            const char* chunk_begin = first;
+            while (chunk_begin != last) {
+                const char* chunk_end = last;
+                if (size_t(last - chunk_begin) > chunk_size) {
+                    const char* eol = (const char*)memchr(chunk_begin + chunk_size, '\n',
+                                                          last - chunk_begin - chunk_size);
+                    if (eol) chunk_end = eol + 1;
+                }
+                chunks.push_back(new detail::lines_chunk_builder(chunk_begin, chunk_end, m_spill_threshold, m_key_index));
+                chunk_begin = chunk_end;
+            }
+
+            boost::thread_group workers;
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                workers.create_thread(boost::ref(chunks[i]));
+            }
+            workers.join_all();
+
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                if (!chunks[i].m_error.empty()) {
+                    throw std::invalid_argument(chunks[i].m_error);
+                }
+                m_nav.append(chunks[i].m_nav);
+                m_bp.append(chunks[i].m_bp);
+                if (m_key_index) {
+                    m_keys.append(chunks[i].m_keys);
+                }
+            }
+        }
+
+        // Indexes in place the newline-separated documents of a mapped
+        // file, without copying the lines
+        void append_mapped(boost::iostreams::mapped_file_source const& m, size_t threads = 1)
+        {
+            append_lines(m.data(), m.data() + m.size(), threads);
+        }
+
+        positions_builder const& nav() const {
+            return m_nav;
+        }
+
+        bits_builder const& bp() const {
+            return m_bp;
+        }
+
+        key_ids_builder const& keys() const {
+            return m_keys;
+        }
+
+    private:
+        size_t m_spill_threshold;
+        bool m_document_index;
+        bool m_key_index;
+        bool m_array_index;
+        positions_builder m_nav;
+        bits_builder m_bp;
+        key_ids_builder m_keys;
+    };
+}
@@ -181,7 +181,7 @@ namespace parser {
         move_to(val, back());
     }
 
-    bool parse(std::string const& s, value& val) 
+    bool spirit_parse(std::string const& s, value& val) 
     {
         string_iter_t first = s.begin(), last = s.end();
         bool ret = phrase_parse(first, last, json_string_parser, boost::spirit::ascii::space, val);
@@ -189,7 +189,7 @@ namespace parser {
     }
 
 
-    bool parse(const char* first, const char* last, value& val) 
+    bool spirit_parse(const char* first, const char* last, value& val) 
     {
         bool ret = phrase_parse(first, last, json_c_str_parser, boost::spirit::ascii::space, val);
         return ret;
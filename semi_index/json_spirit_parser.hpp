@@ -47,7 +47,14 @@ namespace parser {
         }
     };
 
+    // Parse the first value of the input; trailing characters are
+    // ignored. Implemented by the hand-written parser in json_parser.cpp
     bool parse(std::string const& s, value& val);
     bool parse(const char* first, const char* last, value& val);
+
+    // Same as parse(), with the Boost.Spirit grammar. Kept as a
+    // reference for tests and benchmarks
+    bool spirit_parse(std::string const& s, value& val);
+    bool spirit_parse(const char* first, const char* last, value& val);
 }
 }
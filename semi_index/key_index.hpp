@@ -0,0 +1,292 @@
+#pragma once
+
+#include <map>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+#include "succinct/bit_vector.hpp"
+#include "succinct/rs_bit_vector.hpp"
+#include "succinct/mappable_vector.hpp"
+
+#include "escape_table.hpp"
+#include "stream_builder.hpp"
+
+namespace semi_index {
+
+    // Finds the object member keys in [json, json_end). For each
+    // structural character keys.push_key(key) is called if the odd bp
+    // node of the character opens an object member, that is if the
+    // character is '{' or ',' in a non-empty object, and keys.skip()
+    // otherwise. Keys are unescaped the same way check_key does
+    template <typename Iterator, typename KeysBuilder>
+    void scan_json_keys(Iterator json, Iterator json_end, KeysBuilder& keys)
+    {
+        std::vector<bool> in_object;
+        bool pending = false; // the last structural character may open a member
+        std::string key;
+
+        for (; json != json_end; ++json) {
+            char c = *json;
+            switch (c) {
+            case '{':
+            case '[':
+            case '}':
+            case ']':
+            case ',':
+            case ':':
+                if (pending) {
+                    keys.skip();
+                    pending = false;
+                }
+                if (c == '{' || c == '[') {
+                    in_object.push_back(c == '{');
+                    pending = (c == '{');
+                } else if (c == '}' || c == ']') {
+                    if (!in_object.empty()) in_object.pop_back();
+                } else if (c == ',') {
+                    pending = !in_object.empty() && in_object.back();
+                }
+                if (!pending) {
+                    keys.skip();
+                }
+                break;
+
+            case '"':
+                key.clear();
+                while (true) {
+                    if (++json == json_end) {
+                        throw std::invalid_argument("Unterminated string literal");
+                    }
+                    c = *json;
+                    if (c == '"') {
+                        break;
+                    }
+                    if (c == '\\') {
+                        if (++json == json_end) {
+                            throw std::invalid_argument("Unterminated string literal");
+                        }
+                        c = (char)json::parser::escape_table[(unsigned char)*json];
+                    }
+                    if (pending) key += c;
+                }
+                if (pending) {
+                    keys.push_key(key);
+                    pending = false;
+                }
+                break;
+            }
+        }
+        if (pending) {
+            keys.skip();
+        }
+    }
+
+    // Collects one bit per structural character (whether it opens an
+    // object member) and the id of each member key, assigned in order
+    // of first appearance; the ids are stored as varints in a
+    // spill_buffer
+    class key_ids_builder : boost::noncopyable {
+    public:
+        key_ids_builder()
+            : m_num_members(0)
+        {}
+
+        void spill_to_disk(size_t threshold) {
+            m_members.spill_to_disk(threshold);
+            m_ids.spill_to_disk(threshold);
+        }
+
+        void skip() {
+            m_members.push_back(0);
+        }
+
+        void push_key(std::string const& key) {
+            m_members.push_back(1);
+            m_ids.put_varint(key_id(key));
+            ++m_num_members;
+        }
+
+        // Appends the members of other, translating its ids
+        void append(key_ids_builder const& other) {
+            std::vector<uint64_t> remap(other.m_keys.size());
+            for (size_t i = 0; i < other.m_keys.size(); ++i) {
+                remap[i] = key_id(other.m_keys[i]);
+            }
+            spill_buffer::reader ids(other.m_ids);
+            for (uint64_t i = 0; i < other.m_num_members; ++i) {
+                m_ids.put_varint(remap[ids.get_varint()]);
+            }
+            m_num_members += other.m_num_members;
+            m_members.append(other.m_members);
+        }
+
+        uint64_t num_members() const {
+            return m_num_members;
+        }
+
+        friend class key_index;
+
+    private:
+        uint64_t key_id(std::string const& key) {
+            std::map<std::string, uint64_t>::const_iterator it = m_dict.find(key);
+            if (it != m_dict.end()) {
+                return it->second;
+            }
+            uint64_t id = m_keys.size();
+            m_dict[key] = id;
+            m_keys.push_back(key);
+            return id;
+        }
+
+        std::map<std::string, uint64_t> m_dict;
+        std::vector<std::string> m_keys;
+        bits_builder m_members;
+        spill_buffer m_ids;
+        uint64_t m_num_members;
+    };
+
+    // Dictionary of the distinct member keys, sorted, and the key id of
+    // each object member, packed in fixed-width fields. Members are
+    // numbered by the rank of their structural character, so the key
+    // of a member can be compared without reading the JSON text
+    class key_index {
+    public:
+        static const uint64_t not_found = uint64_t(-1);
+
+        key_index()
+            : m_width(0)
+        {}
+
+        key_index(key_ids_builder const& builder)
+        {
+            // ids are renumbered in the order of the sorted keys
+            uint64_t num_keys = builder.m_keys.size();
+            std::vector<uint64_t> remap(num_keys);
+            std::vector<char> chars;
+            std::vector<uint64_t> offsets;
+            typedef std::map<std::string, uint64_t>::const_iterator dict_iter;
+            for (dict_iter it = builder.m_dict.begin(); it != builder.m_dict.end(); ++it) {
+                remap[it->second] = offsets.size();
+                offsets.push_back(chars.size());
+                chars.insert(chars.end(), it->first.begin(), it->first.end());
+            }
+            offsets.push_back(chars.size());
+            m_dict_chars.steal(chars);
+            m_dict_offsets.steal(offsets);
+
+            m_width = 1;
+            while (m_width < 64 && (uint64_t(1) << m_width) < num_keys) {
+                ++m_width;
+            }
+
+            succinct::bit_vector_builder ids;
+            ids.reserve(builder.m_num_members * m_width);
+            spill_buffer::reader ids_stream(builder.m_ids);
+            for (uint64_t i = 0; i < builder.m_num_members; ++i) {
+                ids.append_bits(remap[ids_stream.get_varint()], m_width);
+            }
+            succinct::bit_vector(&ids).swap(m_ids);
+
+            succinct::bit_vector_builder members;
+            builder.m_members.build(members);
+            // select hints for member_node
+            succinct::rs_bit_vector(&members, true).swap(m_members);
+        }
+
+        template <typename Visitor>
+        void map(Visitor& visit) {
+            visit
+                (m_members, "m_members")
+                (m_width, "m_width")
+                (m_ids, "m_ids")
+                (m_dict_chars, "m_dict_chars")
+                (m_dict_offsets, "m_dict_offsets")
+                ;
+        }
+
+        void swap(key_index& other) {
+            m_members.swap(other.m_members);
+            std::swap(m_width, other.m_width);
+            m_ids.swap(other.m_ids);
+            m_dict_chars.swap(other.m_dict_chars);
+            m_dict_offsets.swap(other.m_dict_offsets);
+        }
+
+        bool empty() const {
+            return m_width == 0;
+        }
+
+        uint64_t num_keys() const {
+            return m_dict_offsets.size() ? m_dict_offsets.size() - 1 : 0;
+        }
+
+        std::string key(uint64_t id) const {
+            return std::string(m_dict_chars.begin() + m_dict_offsets[id],
+                               m_dict_chars.begin() + m_dict_offsets[id + 1]);
+        }
+
+        // Id of key, or not_found if no member has it
+        uint64_t key_id(std::string const& key) const {
+            uint64_t lo = 0, hi = num_keys();
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                int cmp = compare(mid, key);
+                if (cmp == 0) {
+                    return mid;
+                } else if (cmp < 0) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return not_found;
+        }
+
+        // Whether the odd bp node opens an object member
+        bool is_member(uint64_t node) const {
+            return m_members[node / 2];
+        }
+
+        // Key id of the member opened by the odd bp node
+        uint64_t member_key_id(uint64_t node) const {
+            assert(is_member(node));
+            return member_key_id_at(m_members.rank(node / 2));
+        }
+
+        // Number of members opened before the bp node
+        uint64_t members_before(uint64_t node) const {
+            return m_members.rank(node / 2);
+        }
+
+        // Key id of the i-th member
+        uint64_t member_key_id_at(uint64_t i) const {
+            return m_ids.get_bits(i * m_width, m_width);
+        }
+
+        // Odd bp node opening the i-th member
+        uint64_t member_node(uint64_t i) const {
+            return 2 * m_members.select(i) + 1;
+        }
+
+    private:
+        int compare(uint64_t id, std::string const& key) const {
+            const char* k = m_dict_chars.begin() + m_dict_offsets[id];
+            size_t len = m_dict_offsets[id + 1] - m_dict_offsets[id];
+            int cmp = memcmp(k, key.data(), std::min(len, key.size()));
+            if (cmp) return cmp;
+            return (len < key.size()) ? -1 : (len > key.size() ? 1 : 0);
+        }
+
+        succinct::rs_bit_vector m_members;
+        uint64_t m_width; // 0 if the index is empty
+        succinct::bit_vector m_ids;
+        succinct::mapper::mappable_vector<char> m_dict_chars;
+        succinct::mapper::mappable_vector<uint64_t> m_dict_offsets;
+    };
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace semi_index {
+
+    namespace detail {
+
+        template <typename Task>
+        class ordered_executor : boost::noncopyable {
+        public:
+            ordered_executor(size_t num_tasks, size_t window, Task& task)
+                : m_num_tasks(num_tasks)
+                , m_window(window)
+                , m_task(task)
+                , m_next_task(0)
+                , m_next_output(0)
+                , m_slots(window)
+                , m_ready(window, false)
+            {}
+
+            // Worker loop: tasks are handed out dynamically, so that idle
+            // threads pick up the next range as soon as they are done,
+            // but never more than window tasks ahead of the output
+            void work(size_t thread) {
+                while (true) {
+                    size_t i;
+                    {
+                        boost::mutex::scoped_lock lock(m_mutex);
+                        while (m_next_task < m_num_tasks &&
+                               m_next_task >= m_next_output + m_window) {
+                            m_cond.wait(lock);
+                        }
+                        if (m_next_task == m_num_tasks) return;
+                        i = m_next_task++;
+                    }
+
+                    std::string out;
+                    m_task(thread, i, out);
+
+                    {
+                        boost::mutex::scoped_lock lock(m_mutex);
+                        m_slots[i % m_window].swap(out);
+                        m_ready[i % m_window] = true;
+                    }
+                    m_cond.notify_all();
+                }
+            }
+
+            template <typename Sink>
+            void drain(Sink& sink) {
+                std::string out;
+                for (size_t i = 0; i < m_num_tasks; ++i) {
+                    {
+                        boost::mutex::scoped_lock lock(m_mutex);
+                        while (!m_ready[i % m_window]) {
+                            m_cond.wait(lock);
+                        }
+                        out.clear();
+                        out.swap(m_slots[i % m_window]);
+                        m_ready[i % m_window] = false;
+                        m_next_output = i + 1;
+                    }
+                    m_cond.notify_all();
+                    sink(out);
+                }
+            }
+
+        private:
+            size_t m_num_tasks;
+            size_t m_window;
+            Task& m_task;
+
+            boost::mutex m_mutex;
+            boost::condition_variable m_cond;
+            size_t m_next_task;
+            size_t m_next_output;
+            std::vector<std::string> m_slots;
+            std::vector<bool> m_ready;
+        };
+
+        template <typename Executor>
+        struct ordered_worker {
+            ordered_worker(Executor& executor, size_t thread)
+                : m_executor(executor)
+                , m_thread(thread)
+            {}
+
+            void operator()() {
+                m_executor.work(m_thread);
+            }
+
+            Executor& m_executor;
+            size_t m_thread;
+        };
+    }
+
+    // Runs task(thread, i, out) for each i in [0, num_tasks) on the given
+    // number of threads, where out is a per-task output buffer, and
+    // passes the buffers to sink(out) in task order, from the calling
+    // thread. Task must be safe to call concurrently with different
+    // thread ids; at most window buffers are kept in memory
+    template <typename Task, typename Sink>
+    void ordered_parallel_for(size_t num_tasks, size_t threads, Task& task, Sink& sink, size_t window = 0)
+    {
+        if (!window) window = 4 * threads;
+        typedef detail::ordered_executor<Task> executor_t;
+        executor_t executor(num_tasks, window, task);
+
+        boost::thread_group workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.create_thread(detail::ordered_worker<executor_t>(executor, t));
+        }
+        executor.drain(sink);
+        workers.join_all();
+    }
+}
@@ -4,6 +4,7 @@
 #include <boost/spirit/include/phoenix_core.hpp>
 #include <boost/spirit/include/phoenix_operator.hpp>
 #include <boost/spirit/include/phoenix_stl.hpp>
+#include <boost/spirit/include/phoenix_object.hpp>
 #include <iostream>
 
 namespace json {
@@ -22,17 +23,36 @@ namespace path {
             path_grammar() : path_grammar::base_type(path_list)
             {
                 using qi::lexeme;
+                using qi::lit;
                 using qi::int_;
                 using ascii::char_;
 		using phoenix::push_back;
+		using phoenix::construct;
                 using namespace qi::labels;
 
-		key = lexeme[+(char_ - '.' - '[' - ',') [_val += _1]];
-		path = -((key [push_back(_val, _1)] >> -('[' >> int_ [push_back(_val, _1)] >> ']')) % '.');
+		key = lexeme[+(char_ - '.' - '[' - ']' - ',') [_val += _1]];
+		// a lone * is the wildcard, * inside a key is a literal
+		any_key = lexeme[lit('*') >> !(char_ - '.' - '[' - ',' - ascii::space)];
+		index = '[' >> ( lit('*') [_val = construct<slice_t>()]
+				 | (-int_ >> ':' >> -int_) [_val = construct<slice_t>(_1, _2)]
+				 | int_ [_val = _1]
+				 ) >> ']';
+		indices = *(index [push_back(_r1, _1)]);
+		step = ( any_key [push_back(_r1, construct<any_key_t>())]
+			 | key [push_back(_r1, _1)]
+			 ) >> indices(_r1)
+		    | +(index [push_back(_r1, _1)]);
+		descendant = lit("..") >> key [push_back(_r1, construct<descendant_t>(_1))] >> indices(_r1);
+		path = -( (descendant(_val) | step(_val)) >> *(descendant(_val) | ('.' >> step(_val))) );
 		path_list = -(path % ',');
             }
 
             qi::rule<Iterator, std::string(), ascii::space_type> key;
+            qi::rule<Iterator, ascii::space_type> any_key;
+            qi::rule<Iterator, path_element_t(), ascii::space_type> index;
+            qi::rule<Iterator, void(path_t&), ascii::space_type> indices;
+            qi::rule<Iterator, void(path_t&), ascii::space_type> step;
+            qi::rule<Iterator, void(path_t&), ascii::space_type> descendant;
             qi::rule<Iterator, path_t(), ascii::space_type> path;
             qi::rule<Iterator, path_list_t(), ascii::space_type> path_list;
         };
@@ -50,4 +70,74 @@ namespace path {
 	}
 	return paths;
     }
+
+    namespace {
+        struct is_multi_valued_visitor : boost::static_visitor<bool> {
+            bool operator()(std::string const&) const { return false; }
+            bool operator()(int) const { return false; }
+            bool operator()(slice_t const&) const { return true; }
+            bool operator()(any_key_t const&) const { return true; }
+            bool operator()(descendant_t const&) const { return true; }
+        };
+    }
+
+    bool is_multi_valued(path_t const& path)
+    {
+        for (size_t i = 0; i < path.size(); ++i) {
+            if (boost::apply_visitor(is_multi_valued_visitor(), path[i])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    namespace {
+        template <typename T>
+        size_t find_or_add_child(std::vector<path_trie::node>& nodes, size_t parent, 
+                                 std::vector<std::pair<T, size_t> > path_trie::node::* children, T const& label)
+        {
+            std::vector<std::pair<T, size_t> >& edges = nodes[parent].*children;
+            for (size_t i = 0; i < edges.size(); ++i) {
+                if (edges[i].first == label) {
+                    return edges[i].second;
+                }
+            }
+            size_t child = nodes.size();
+            nodes.push_back(path_trie::node());
+            (nodes[parent].*children).push_back(std::make_pair(label, child));
+            return child;
+        }
+    }
+
+    path_trie::path_trie(path_list_t const& paths)
+        : nodes(1)
+        , num_paths(paths.size())
+    {
+        for (size_t p = 0; p < paths.size(); ++p) {
+            size_t cur = 0;
+            for (size_t i = 0; i < paths[p].size(); ++i) {
+                const std::string* key;
+                const int* idx;
+                const slice_t* slice;
+                const descendant_t* descendant;
+                if ((key = boost::get<std::string>(&paths[p][i]))) {
+                    cur = find_or_add_child(nodes, cur, &node::keys, *key);
+                } else if ((idx = boost::get<int>(&paths[p][i]))) {
+                    cur = find_or_add_child(nodes, cur, &node::indices, *idx);
+                } else if ((slice = boost::get<slice_t>(&paths[p][i]))) {
+                    cur = find_or_add_child(nodes, cur, &node::slices, *slice);
+                } else if ((descendant = boost::get<descendant_t>(&paths[p][i]))) {
+                    cur = find_or_add_child(nodes, cur, &node::descendants, descendant->key);
+                } else if (boost::get<any_key_t>(&paths[p][i])) {
+                    if (!nodes[cur].any_key) {
+                        nodes[cur].any_key = nodes.size();
+                        nodes.push_back(node());
+                    }
+                    cur = nodes[cur].any_key;
+                }
+            }
+            nodes[cur].paths.push_back(p);
+            multi_valued.push_back(is_multi_valued(paths[p]));
+        }
+    }
 }}
@@ -6,18 +6,87 @@
 
 #include <boost/variant/variant.hpp>
 #include <boost/variant/get.hpp>
+#include <boost/optional.hpp>
 
 namespace json {
 namespace path {
 
+    // [first:last] with Python semantics: negative bounds count from the
+    // end of the array, missing bounds are the ends of the array. [*] is
+    // the slice with no bounds
+    struct slice_t {
+        slice_t() {}
+        slice_t(boost::optional<int> const& first_, boost::optional<int> const& last_)
+            : first(first_)
+            , last(last_)
+        {}
+
+        bool operator==(slice_t const& other) const {
+            return first == other.first && last == other.last;
+        }
+
+        boost::optional<int> first;
+        boost::optional<int> last;
+    };
+
+    // *, the values of all the members of an object
+    struct any_key_t {
+        bool operator==(any_key_t const&) const {
+            return true;
+        }
+    };
+
+    // ..key, the values of the members with the given key at any depth
+    struct descendant_t {
+        descendant_t() {}
+        explicit descendant_t(std::string const& key_)
+            : key(key_)
+        {}
+
+        bool operator==(descendant_t const& other) const {
+            return key == other.key;
+        }
+
+        std::string key;
+    };
+
     typedef boost::variant<
         std::string,
-	int
+	int,
+        slice_t,
+        any_key_t,
+        descendant_t
 	> path_element_t;
     
     typedef std::vector<path_element_t> path_t;
     typedef std::vector<path_t> path_list_t;
 
     path_list_t parse(std::string const& s);
-}}
 
+    // Whether the path can match more than one value, that is if it
+    // contains slices, wildcards or recursive descents
+    bool is_multi_valued(path_t const& path);
+
+    // A list of paths merged by common prefix, so that the shared
+    // prefixes are navigated only once and all the children requested at
+    // the same level are resolved together
+    struct path_trie {
+        struct node {
+            node() : any_key(0) {}
+
+            std::vector<std::pair<std::string, size_t> > keys; // object children
+            std::vector<std::pair<int, size_t> > indices; // array children
+            std::vector<std::pair<slice_t, size_t> > slices; // array children ranges
+            size_t any_key; // all the object children, 0 if none
+            std::vector<std::pair<std::string, size_t> > descendants; // object descendants
+            std::vector<size_t> paths; // ids of the paths ending at this node
+        };
+
+        path_trie() : num_paths(0) {}
+        explicit path_trie(path_list_t const& paths);
+
+        std::vector<node> nodes; // nodes[0] is the root
+        size_t num_paths;
+        std::vector<bool> multi_valued; // is_multi_valued() of each path
+    };
+}}
@@ -0,0 +1,189 @@
+#include "predicate.hpp"
+
+#include <stdexcept>
+
+namespace json {
+namespace predicate {
+
+    namespace {
+
+        using semi_index::detail::is_json_space;
+
+        // Recursive descent parser of the expressions, building the
+        // nodes bottom-up
+        class expression_parser {
+        public:
+            expression_parser(std::string const& s, expression& expr)
+                : m_s(s)
+                , m_pos(0)
+                , m_expr(expr)
+            {}
+
+            void parse() {
+                skip_space();
+                if (m_pos == m_s.size()) {
+                    return; // empty expression
+                }
+                m_expr.root = parse_or();
+                skip_space();
+                if (m_pos != m_s.size()) {
+                    error();
+                }
+            }
+
+        private:
+            void error() const {
+                throw std::invalid_argument(std::string("Parsing error: unexpected \"") + m_s.substr(m_pos) + "\"");
+            }
+
+            void skip_space() {
+                while (m_pos < m_s.size() && is_json_space(m_s[m_pos])) ++m_pos;
+            }
+
+            // Characters that end a path
+            static bool is_delimiter(char c) {
+                return is_json_space(c) || strchr("=!<>()", c);
+            }
+
+            bool keyword(const char* kw) {
+                skip_space();
+                size_t len = strlen(kw);
+                if (m_s.compare(m_pos, len, kw) != 0) {
+                    return false;
+                }
+                if (m_pos + len < m_s.size() && !is_delimiter(m_s[m_pos + len])) {
+                    return false;
+                }
+                m_pos += len;
+                return true;
+            }
+
+            bool symbol(const char* sym) {
+                size_t len = strlen(sym);
+                if (m_s.compare(m_pos, len, sym) != 0) {
+                    return false;
+                }
+                m_pos += len;
+                return true;
+            }
+
+            size_t add_node(expression::node::kind_t kind, size_t left, size_t right) {
+                expression::node n;
+                n.kind = kind;
+                n.left = left;
+                n.right = right;
+                m_expr.nodes.push_back(n);
+                return m_expr.nodes.size() - 1;
+            }
+
+            size_t parse_or() {
+                size_t left = parse_and();
+                while (keyword("or")) {
+                    size_t right = parse_and();
+                    left = add_node(expression::node::or_kind, left, right);
+                }
+                return left;
+            }
+
+            size_t parse_and() {
+                size_t left = parse_unary();
+                while (keyword("and")) {
+                    size_t right = parse_unary();
+                    left = add_node(expression::node::and_kind, left, right);
+                }
+                return left;
+            }
+
+            size_t parse_unary() {
+                if (keyword("not")) {
+                    return add_node(expression::node::not_kind, parse_unary(), 0);
+                }
+                skip_space();
+                if (symbol("(")) {
+                    size_t n = parse_or();
+                    skip_space();
+                    if (!symbol(")")) error();
+                    return n;
+                }
+                return parse_comparison();
+            }
+
+            size_t parse_comparison() {
+                comparison_t cmp;
+
+                skip_space();
+                size_t path_begin = m_pos;
+                while (m_pos < m_s.size() && !is_delimiter(m_s[m_pos])) ++m_pos;
+                path::path_list_t paths = path::parse(m_s.substr(path_begin, m_pos - path_begin));
+                if (paths.size() != 1 || paths[0].empty()) {
+                    m_pos = path_begin;
+                    error();
+                }
+                cmp.path = paths[0];
+                cmp.trie = path::path_trie(paths);
+
+                skip_space();
+                if (symbol("==")) cmp.op = op_eq;
+                else if (symbol("!=")) cmp.op = op_ne;
+                else if (symbol("<=")) cmp.op = op_le;
+                else if (symbol(">=")) cmp.op = op_ge;
+                else if (symbol("<")) cmp.op = op_lt;
+                else if (symbol(">")) cmp.op = op_gt;
+                else error();
+
+                skip_space();
+                size_t literal_begin = m_pos;
+                parse_literal(cmp.value);
+                if (cmp.op != op_eq && cmp.op != op_ne && cmp.value.kind != literal_t::number_kind) {
+                    m_pos = literal_begin;
+                    error();
+                }
+
+                m_expr.comparisons.push_back(cmp);
+                return add_node(expression::node::comparison_kind, m_expr.comparisons.size() - 1, 0);
+            }
+
+            void parse_literal(literal_t& lit) {
+                if (symbol("\"")) {
+                    size_t begin = m_pos;
+                    while (m_pos < m_s.size() && m_s[m_pos] != '"') {
+                        m_pos += (m_s[m_pos] == '\\') ? 2 : 1;
+                    }
+                    if (m_pos >= m_s.size()) {
+                        m_pos = begin - 1;
+                        error();
+                    }
+                    lit.kind = literal_t::string_kind;
+                    lit.raw = m_s.substr(begin, m_pos - begin);
+                    semi_index::detail::unescape(lit.raw.data(), 0, lit.raw.size(), lit.str);
+                    ++m_pos;
+                } else if (keyword("true")) {
+                    lit.kind = literal_t::bool_kind;
+                    lit.boolean = true;
+                } else if (keyword("false")) {
+                    lit.kind = literal_t::bool_kind;
+                    lit.boolean = false;
+                } else if (keyword("null")) {
+                    lit.kind = literal_t::null_kind;
+                } else {
+                    const char* first = m_s.data() + m_pos;
+                    const char* end = semi_index::detail::parse_number(first, m_s.data() + m_s.size(), lit.number);
+                    if (!end) error();
+                    lit.kind = literal_t::number_kind;
+                    m_pos += end - first;
+                }
+            }
+
+            std::string const& m_s;
+            size_t m_pos;
+            expression& m_expr;
+        };
+    }
+
+    expression parse(std::string const& s)
+    {
+        expression expr;
+        expression_parser(s, expr).parse();
+        return expr;
+    }
+}}
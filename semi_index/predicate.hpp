@@ -0,0 +1,208 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+
+#include "path_parser.hpp"
+#include "value_decoder.hpp"
+
+namespace json {
+namespace predicate {
+
+    enum op_t {
+        op_eq,
+        op_ne,
+        op_lt,
+        op_le,
+        op_gt,
+        op_ge
+    };
+
+    struct literal_t {
+        enum kind_t {
+            null_kind,
+            bool_kind,
+            number_kind,
+            string_kind
+        };
+
+        literal_t()
+            : kind(null_kind)
+            , boolean(false)
+            , number(0)
+        {}
+
+        kind_t kind;
+        bool boolean;
+        double number;
+        std::string raw; // string contents as written, with the escapes
+        std::string str; // string contents with the escapes decoded
+    };
+
+    // path op literal. Multi-valued paths satisfy the comparison if any
+    // of their matches does
+    struct comparison_t {
+        path::path_t path;
+        path::path_trie trie; // of path alone
+        op_t op;
+        literal_t value;
+    };
+
+    // Boolean combination of comparisons, stored as a tree of nodes
+    // referring to each other by index
+    struct expression {
+        struct node {
+            enum kind_t {
+                and_kind,
+                or_kind,
+                not_kind,
+                comparison_kind
+            };
+
+            kind_t kind;
+            size_t left; // operand of not, comparison index of comparisons
+            size_t right;
+        };
+
+        expression() : root(0) {}
+
+        // The empty expression accepts all the documents
+        bool empty() const {
+            return nodes.empty();
+        }
+
+        std::vector<node> nodes;
+        std::vector<comparison_t> comparisons;
+        size_t root;
+    };
+
+    // Parses expressions such as
+    //
+    //     action == "delete" and (id > 1000 or not user.anonymous == true)
+    //
+    // where the left side of the comparisons is a path and the right
+    // side a JSON scalar. and binds tighter than or. Strings can only be
+    // compared for equality. Throws std::invalid_argument on syntax
+    // errors
+    expression parse(std::string const& s);
+
+    namespace detail {
+
+        template <typename Iterator>
+        bool raw_equal(Iterator first, Iterator last, std::string const& raw) {
+            return size_t(last - first) == raw.size() && std::equal(raw.begin(), raw.end(), first);
+        }
+
+        inline bool raw_equal(const char* first, const char* last, std::string const& raw) {
+            return size_t(last - first) == raw.size() && !memcmp(first, raw.data(), raw.size());
+        }
+
+        template <typename T>
+        bool compare(T const& a, op_t op, T const& b) {
+            switch (op) {
+            case op_eq: return a == b;
+            case op_ne: return !(a == b);
+            case op_lt: return a < b;
+            case op_le: return a <= b;
+            case op_gt: return a > b;
+            case op_ge: return a >= b;
+            }
+            return false;
+        }
+
+        template <typename Accessor, typename Iterator>
+        bool string_equal(Accessor const& value, std::pair<Iterator, Iterator> raw,
+                          literal_t const& lit, std::string& buffer) {
+            if (raw_equal(raw.first, raw.second, lit.raw)) {
+                return true;
+            }
+            if (std::find(raw.first, raw.second, '\\') == raw.second) {
+                // the value is already decoded, the literal may not be
+                return lit.raw != lit.str && raw_equal(raw.first, raw.second, lit.str);
+            }
+            semi_index::string_view_t str = value.as_unescaped_string(buffer);
+            return size_t(str.second - str.first) == lit.str.size() &&
+                std::equal(lit.str.begin(), lit.str.end(), str.first);
+        }
+
+        // Compares the value in place: strings are compared on their
+        // escaped form, and decoded only if it differs and contains
+        // escapes; numbers are parsed by the fast path of parse_number.
+        // Values of a different type than the literal, and missing
+        // values, are only different from it
+        template <typename Accessor>
+        bool compare_value(Accessor const& value, op_t op, literal_t const& lit, std::string& buffer) {
+            bool equal = false;
+            switch (value.type()) {
+            case semi_index::null_type:
+                equal = (lit.kind == literal_t::null_kind);
+                break;
+            case semi_index::bool_type:
+                equal = (lit.kind == literal_t::bool_kind && value.as_bool() == lit.boolean);
+                break;
+            case semi_index::number_type:
+                if (lit.kind == literal_t::number_kind) {
+                    return compare(value.as_double(), op, lit.number);
+                }
+                break;
+            case semi_index::string_type:
+                if (lit.kind == literal_t::string_kind) {
+                    equal = string_equal(value, value.as_raw_string(), lit, buffer);
+                }
+                break;
+            default:
+                break;
+            }
+            // only numbers are ordered, the parser rejects the other
+            // literals with ordering operators
+            return (op == op_ne) ? !equal : (op == op_eq && equal);
+        }
+    }
+
+    // Evaluates the expression on the document at root, navigating only
+    // the paths of the comparisons that are needed: and and or stop at
+    // the first operand that decides the result. values and matches are
+    // scratch space
+    template <typename Accessor>
+    bool evaluate(expression const& expr, Accessor const& root, std::vector<Accessor>& values,
+                  std::vector<std::pair<size_t, Accessor> >& matches, size_t node_idx) {
+        expression::node const& node = expr.nodes[node_idx];
+        switch (node.kind) {
+        case expression::node::and_kind:
+            return evaluate(expr, root, values, matches, node.left) &&
+                evaluate(expr, root, values, matches, node.right);
+        case expression::node::or_kind:
+            return evaluate(expr, root, values, matches, node.left) ||
+                evaluate(expr, root, values, matches, node.right);
+        case expression::node::not_kind:
+            return !evaluate(expr, root, values, matches, node.left);
+        case expression::node::comparison_kind:
+            break;
+        }
+
+        comparison_t const& cmp = expr.comparisons[node.left];
+        std::string buffer;
+        root.get_paths(cmp.trie, values, matches);
+        if (!cmp.trie.multi_valued[0]) {
+            return detail::compare_value(values[0], cmp.op, cmp.value, buffer);
+        }
+        if (matches.empty()) {
+            return detail::compare_value(Accessor(), cmp.op, cmp.value, buffer);
+        }
+        for (size_t i = 0; i < matches.size(); ++i) {
+            if (detail::compare_value(matches[i].second, cmp.op, cmp.value, buffer)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Accessor>
+    bool evaluate(expression const& expr, Accessor const& root, std::vector<Accessor>& values,
+                  std::vector<std::pair<size_t, Accessor> >& matches) {
+        return expr.empty() || evaluate(expr, root, values, matches, expr.root);
+    }
+}}
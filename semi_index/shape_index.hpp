@@ -0,0 +1,542 @@
+#pragma once
+
+#include <map>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+#include "succinct/bit_vector.hpp"
+#include "succinct/elias_fano.hpp"
+#include "succinct/mappable_vector.hpp"
+#include "succinct/broadword.hpp"
+
+#include "escape_table.hpp"
+#include "json_scanner.hpp"
+#include "path_parser.hpp"
+#include "stream_builder.hpp"
+#include "value_decoder.hpp"
+
+namespace semi_index {
+
+    namespace detail {
+
+        // NavBuilder that records the offsets of the structural
+        // characters instead of the bits
+        class structural_offsets {
+        public:
+            structural_offsets()
+                : m_size(0)
+            {}
+
+            void clear() {
+                m_offsets.clear();
+                m_size = 0;
+            }
+
+            void push_back(bool b) {
+                if (b) m_offsets.push_back(m_size);
+                ++m_size;
+            }
+
+            void append_bits(uint64_t bits, size_t len) {
+                unsigned long bit;
+                while (succinct::broadword::lsb(bits, bit)) {
+                    m_offsets.push_back(m_size + bit);
+                    bits &= bits - 1;
+                }
+                m_size += len;
+            }
+
+            void zero_extend(uint64_t n) {
+                m_size += n;
+            }
+
+            std::vector<uint64_t> const& offsets() const {
+                return m_offsets;
+            }
+
+        private:
+            std::vector<uint64_t> m_offsets;
+            uint64_t m_size;
+        };
+
+        // BpBuilder that drops the parentheses
+        struct null_bits_builder {
+            void push_back(bool) {}
+            void append_bits(uint64_t, size_t) {}
+            void zero_extend(uint64_t) {}
+        };
+
+        inline bool is_opener(char c) {
+            return c == '{' || c == '[';
+        }
+
+        inline bool is_value_end(char c) {
+            return c == ',' || c == '}' || c == ']';
+        }
+
+        inline void put_varint(std::string& s, uint64_t v) {
+            while (v >= 128) {
+                s += char((v & 127) | 128);
+                v >>= 7;
+            }
+            s += char(v);
+        }
+
+        inline uint64_t get_varint(const char*& p) {
+            uint64_t v = 0;
+            for (size_t shift = 0; ; shift += 7) {
+                uint8_t c = uint8_t(*p++);
+                v |= uint64_t(c & 127) << shift;
+                if (c < 128) return v;
+            }
+        }
+    }
+
+    // The shape of a document is its text without the scalar values:
+    // the structural characters, the keys and the whitespace around
+    // them. Documents of a collection of logs usually have only a few
+    // shapes, so each shape is stored once and each document stores
+    // its shape id, its position and the ends of its scalar values. In
+    // the shape, the gap of text after each structural character is
+    // either variable (a scalar value, or the single element of an
+    // array) or fixed and stored verbatim
+    class shape_index_builder : boost::noncopyable {
+    public:
+        shape_index_builder()
+            : m_size(0)
+            , m_num_docs(0)
+            , m_num_slots(0)
+        {}
+
+        void spill_to_disk(size_t threshold) {
+            m_shape_ids.spill_to_disk(threshold);
+            m_docs.spill_to_disk(threshold);
+            m_doc_slots.spill_to_disk(threshold);
+            m_values.spill_to_disk(threshold);
+        }
+
+        // Appends the newline-separated documents in [first, last), one
+        // per line; lines without structural characters are skipped, as
+        // they do not contain a document in the semi-index either
+        void append_lines(const char* first, const char* last)
+        {
+            const char* begin = first;
+            while (first != last) {
+                const char* eol = (const char*)memchr(first, '\n', last - first);
+                const char* next = eol ? eol + 1 : last;
+                append_document(first, next, m_size + (first - begin));
+                first = next;
+            }
+            m_size += last - begin;
+        }
+
+        uint64_t num_documents() const {
+            return m_num_docs;
+        }
+
+        uint64_t num_shapes() const {
+            return m_shapes.size();
+        }
+
+        friend class shape_index;
+
+    private:
+        void append_document(const char* line, const char* line_end, uint64_t base) {
+            m_offsets.clear();
+            detail::null_bits_builder bp;
+            scan_json(line, line_end, m_offsets, bp);
+            std::vector<uint64_t> const& o = m_offsets.offsets();
+            if (o.empty()) return;
+            uint64_t first_slot = m_num_slots;
+
+            // each structural character is followed by 0 and the end of
+            // the variable gap after it, or by 1 and the fixed gap
+            m_shape.clear();
+            m_in_array.clear();
+            for (size_t t = 0; t < o.size(); ++t) {
+                char c = line[o[t]];
+                m_shape += c;
+                if (c == '{' || c == '[') m_in_array.push_back(c == '[');
+                if ((c == '}' || c == ']') && !m_in_array.empty()) m_in_array.pop_back();
+                if (t + 1 == o.size()) break;
+
+                const char* gap = line + o[t] + 1;
+                const char* gap_end = line + o[t + 1];
+                char next = line[o[t + 1]];
+                bool value_slot = (c == ':' || c == '[' ||
+                                   (c == ',' && !m_in_array.empty() && m_in_array.back()));
+                bool variable = value_slot && detail::is_value_end(next);
+                if (c == '[' && next == ']') {
+                    // empty arrays are part of the shape
+                    variable = false;
+                    for (const char* p = gap; p != gap_end; ++p) {
+                        if (!detail::is_json_space(*p)) variable = true;
+                    }
+                }
+                if (variable) {
+                    m_shape += '\0';
+                    m_values.zero_extend(base + o[t + 1] - m_values.size());
+                    m_values.push_back(1);
+                    ++m_num_slots;
+                } else {
+                    m_shape += '\1';
+                    detail::put_varint(m_shape, gap_end - gap);
+                    m_shape.append(gap, gap_end);
+                }
+            }
+
+            std::map<std::string, uint64_t>::const_iterator it = m_shapes.find(m_shape);
+            uint64_t id;
+            if (it != m_shapes.end()) {
+                id = it->second;
+            } else {
+                id = m_shapes.size();
+                m_shapes[m_shape] = id;
+            }
+            m_shape_ids.put_varint(id);
+
+            m_docs.zero_extend(base + o[0] - m_docs.size());
+            m_docs.push_back(1);
+            // slots before the document plus document id, so that the
+            // positions are strictly increasing
+            m_doc_slots.zero_extend(first_slot + m_num_docs - m_doc_slots.size());
+            m_doc_slots.push_back(1);
+            ++m_num_docs;
+        }
+
+        uint64_t m_size;
+        uint64_t m_num_docs;
+        uint64_t m_num_slots;
+        std::map<std::string, uint64_t> m_shapes;
+        spill_buffer m_shape_ids;
+        positions_builder m_docs;      // first structural character of each document
+        positions_builder m_doc_slots;
+        positions_builder m_values;    // end of each variable gap
+
+        // scratch space
+        detail::structural_offsets m_offsets;
+        std::string m_shape;
+        std::vector<bool> m_in_array;
+    };
+
+    class shape_index {
+    public:
+        typedef std::pair<size_t, size_t> range_t;
+
+        shape_index()
+            : m_width(0)
+        {}
+
+        shape_index(shape_index_builder& builder)
+        {
+            // shapes are stored in order of id
+            std::vector<std::string const*> shapes(builder.m_shapes.size());
+            typedef std::map<std::string, uint64_t>::const_iterator shapes_iter;
+            for (shapes_iter it = builder.m_shapes.begin(); it != builder.m_shapes.end(); ++it) {
+                shapes[it->second] = &it->first;
+            }
+            std::vector<char> chars;
+            std::vector<uint64_t> offsets;
+            for (size_t i = 0; i < shapes.size(); ++i) {
+                offsets.push_back(chars.size());
+                chars.insert(chars.end(), shapes[i]->begin(), shapes[i]->end());
+            }
+            offsets.push_back(chars.size());
+            m_shape_chars.steal(chars);
+            m_shape_offsets.steal(offsets);
+
+            m_width = 1;
+            while (m_width < 64 && (uint64_t(1) << m_width) < shapes.size()) {
+                ++m_width;
+            }
+            succinct::bit_vector_builder ids;
+            ids.reserve(builder.m_num_docs * m_width);
+            spill_buffer::reader ids_stream(builder.m_shape_ids);
+            for (uint64_t i = 0; i < builder.m_num_docs; ++i) {
+                ids.append_bits(ids_stream.get_varint(), m_width);
+            }
+            succinct::bit_vector(&ids).swap(m_shape_ids);
+
+            builder.m_docs.zero_extend(builder.m_size + 1 - builder.m_docs.size());
+            builder.m_docs.build(m_docs);
+            builder.m_doc_slots.zero_extend(builder.m_num_slots + builder.m_num_docs + 1 - builder.m_doc_slots.size());
+            builder.m_doc_slots.build(m_doc_slots);
+            builder.m_values.zero_extend(builder.m_size + 1 - builder.m_values.size());
+            builder.m_values.build(m_values);
+        }
+
+        template <typename Visitor>
+        void map(Visitor& visit) {
+            visit
+                (m_shape_chars, "m_shape_chars")
+                (m_shape_offsets, "m_shape_offsets")
+                (m_width, "m_width")
+                (m_shape_ids, "m_shape_ids")
+                (m_docs, "m_docs")
+                (m_doc_slots, "m_doc_slots")
+                (m_values, "m_values")
+                ;
+        }
+
+        void swap(shape_index& other) {
+            m_shape_chars.swap(other.m_shape_chars);
+            m_shape_offsets.swap(other.m_shape_offsets);
+            std::swap(m_width, other.m_width);
+            m_shape_ids.swap(other.m_shape_ids);
+            m_docs.swap(other.m_docs);
+            m_doc_slots.swap(other.m_doc_slots);
+            m_values.swap(other.m_values);
+        }
+
+        uint64_t num_documents() const {
+            return m_docs.num_ones();
+        }
+
+        uint64_t num_shapes() const {
+            return m_shape_offsets.size() ? m_shape_offsets.size() - 1 : 0;
+        }
+
+        uint64_t shape_id(uint64_t doc) const {
+            return m_shape_ids.get_bits(doc * m_width, m_width);
+        }
+
+        // Encoded shape, see shape_index_builder
+        std::pair<const char*, const char*> shape(uint64_t id) const {
+            return std::make_pair(m_shape_chars.begin() + m_shape_offsets[id],
+                                  m_shape_chars.begin() + m_shape_offsets[id + 1]);
+        }
+
+        // Position of the first structural character of the document
+        uint64_t document_position(uint64_t doc) const {
+            return m_docs.select(doc);
+        }
+
+        // Position of the anchor-th anchor of the document: 0 is the
+        // first structural character, i > 0 the end of the (i - 1)-th
+        // variable gap
+        uint64_t anchor_position(uint64_t doc, uint64_t anchor) const {
+            if (anchor == 0) {
+                return document_position(doc);
+            }
+            uint64_t first_slot = m_doc_slots.select(doc) - doc;
+            return m_values.select(first_slot + anchor - 1);
+        }
+
+    private:
+        succinct::mapper::mappable_vector<char> m_shape_chars;
+        succinct::mapper::mappable_vector<uint64_t> m_shape_offsets;
+        uint64_t m_width;
+        succinct::bit_vector m_shape_ids;
+        succinct::elias_fano m_docs;
+        succinct::elias_fano m_doc_slots;
+        succinct::elias_fano m_values;
+    };
+
+    // Single-valued paths of keys and indices, resolved once per shape
+    // to a pair of anchors and offsets from them, so that the range of a
+    // path in a document costs two selects. The resolutions are cached,
+    // so a resolver must not be shared between threads
+    class shape_path_resolver {
+    public:
+        // Throws std::invalid_argument on multi-valued paths
+        shape_path_resolver(shape_index const& index, json::path::path_list_t const& paths)
+            : m_index(index)
+            , m_paths(paths)
+            , m_resolved(index.num_shapes())
+        {
+            for (size_t i = 0; i < paths.size(); ++i) {
+                if (json::path::is_multi_valued(paths[i])) {
+                    throw std::invalid_argument("The shape index only supports single-valued paths");
+                }
+            }
+        }
+
+        // Range of the value of the path_id-th path in the document,
+        // as json_semi_index::accessor::get_range, false if missing
+        bool get_range(uint64_t doc, size_t path_id, shape_index::range_t& r) {
+            uint64_t shape = m_index.shape_id(doc);
+            if (m_resolved[shape].empty()) {
+                resolve(shape);
+            }
+            slot_ref const& ref = m_resolved[shape][path_id];
+            if (!ref.found) {
+                return false;
+            }
+            r.first = m_index.anchor_position(doc, ref.start_anchor) + ref.start_delta;
+            r.second = m_index.anchor_position(doc, ref.end_anchor) + ref.end_delta;
+            return true;
+        }
+
+    private:
+        struct slot_ref {
+            slot_ref()
+                : found(false)
+            {}
+
+            bool found;
+            uint64_t start_anchor;
+            uint64_t start_delta;
+            uint64_t end_anchor;
+            uint64_t end_delta;
+        };
+
+        // The decoded shape: for each structural character t, its
+        // anchor and offset from it, the gap after it (null if
+        // variable) and its matching closer if it is an opener
+        struct decoded_shape {
+            std::string chars;
+            std::vector<uint64_t> anchors;
+            std::vector<uint64_t> deltas;
+            std::vector<std::string> gaps;
+            std::vector<bool> fixed;
+            std::vector<size_t> closers;
+        };
+
+        void resolve(uint64_t shape_id) {
+            decoded_shape s;
+            decode(shape_id, s);
+            std::vector<slot_ref>& refs = m_resolved[shape_id];
+            refs.resize(m_paths.size());
+            for (size_t i = 0; i < m_paths.size(); ++i) {
+                slot_ref& ref = refs[i];
+                if (m_paths[i].empty()) {
+                    // the whole document
+                    size_t end = s.closers[0];
+                    ref.found = true;
+                    ref.start_anchor = s.anchors[0];
+                    ref.start_delta = s.deltas[0];
+                    ref.end_anchor = s.anchors[end];
+                    ref.end_delta = s.deltas[end] + 1;
+                    continue;
+                }
+                size_t first, last;
+                if (!find(s, m_paths[i], first, last)) {
+                    continue;
+                }
+                ref.found = true;
+                ref.start_anchor = s.anchors[first];
+                ref.start_delta = s.deltas[first] + 1;
+                ref.end_anchor = s.anchors[last];
+                ref.end_delta = s.deltas[last];
+            }
+        }
+
+        void decode(uint64_t shape_id, decoded_shape& s) const {
+            std::pair<const char*, const char*> enc = m_index.shape(shape_id);
+            const char* p = enc.first;
+            uint64_t anchor = 0, delta = 0, num_variable = 0;
+            std::vector<size_t> open;
+            while (p != enc.second) {
+                char c = *p++;
+                size_t t = s.chars.size();
+                s.chars += c;
+                s.anchors.push_back(anchor);
+                s.deltas.push_back(delta);
+                s.closers.push_back(t);
+                if (detail::is_opener(c)) {
+                    open.push_back(t);
+                } else if ((c == '}' || c == ']') && !open.empty()) {
+                    s.closers[open.back()] = t;
+                    open.pop_back();
+                }
+                if (p == enc.second) {
+                    s.gaps.push_back(std::string());
+                    s.fixed.push_back(true);
+                    break;
+                }
+                if (*p++ == '\0') {
+                    s.gaps.push_back(std::string());
+                    s.fixed.push_back(false);
+                    anchor = ++num_variable;
+                    delta = 0;
+                } else {
+                    uint64_t len = detail::get_varint(p);
+                    s.gaps.push_back(std::string(p, p + len));
+                    s.fixed.push_back(true);
+                    p += len;
+                    delta += 1 + len;
+                }
+            }
+        }
+
+        // Key of the member whose key gap is gap, unescaped as
+        // json_semi_index::check_key does
+        static std::string gap_key(std::string const& gap) {
+            std::string key;
+            size_t i = gap.find('"');
+            if (i == std::string::npos) return key;
+            for (++i; i < gap.size() && gap[i] != '"'; ++i) {
+                char c = gap[i];
+                if (c == '\\' && i + 1 < gap.size()) {
+                    c = (char)json::parser::escape_table[(unsigned char)gap[++i]];
+                }
+                key += c;
+            }
+            return key;
+        }
+
+        // Structural characters before (first) and after (last) the
+        // value of path, whose range is thus between them
+        static bool find(decoded_shape const& s, json::path::path_t const& path, size_t& first, size_t& last) {
+            size_t container = 0;
+            for (size_t e = 0; e < path.size(); ++e) {
+                if (e) {
+                    // the value must be a container
+                    if (first + 1 >= s.chars.size() || !detail::is_opener(s.chars[first + 1]) ||
+                        s.closers[first + 1] + 1 != last) {
+                        return false;
+                    }
+                    container = first + 1;
+                }
+                char c = s.chars[container];
+                size_t end = s.closers[container];
+                if (std::string const* key = boost::get<std::string>(&path[e])) {
+                    if (c != '{' || end == container + 1) return false;
+                    bool found = false;
+                    for (size_t sep = container; sep < end && s.chars[sep] != '}'; sep = last) {
+                        first = sep + 1; // the ':'
+                        last = value_end(s, first);
+                        if (gap_key(s.gaps[sep]) == *key) {
+                            found = true;
+                            break;
+                        }
+                    }
+                    if (!found) return false;
+                } else {
+                    int i = boost::get<int>(path[e]);
+                    if (c != '[') return false;
+                    std::vector<std::pair<size_t, size_t> > elements;
+                    if (!(end == container + 1 && s.fixed[container])) {
+                        for (size_t sep = container; sep < end; sep = elements.back().second) {
+                            elements.push_back(std::make_pair(sep, value_end(s, sep)));
+                            if (s.chars[elements.back().second] != ',') break;
+                        }
+                    }
+                    if (i < 0) i += int(elements.size());
+                    if (i < 0 || size_t(i) >= elements.size()) return false;
+                    first = elements[i].first;
+                    last = elements[i].second;
+                }
+            }
+            return true;
+        }
+
+        // Structural character that ends the value opened by t
+        static size_t value_end(decoded_shape const& s, size_t t) {
+            if (t + 1 < s.chars.size() && detail::is_opener(s.chars[t + 1]) && s.fixed[t]) {
+                return s.closers[t + 1] + 1;
+            }
+            return t + 1;
+        }
+
+        shape_index const& m_index;
+        json::path::path_list_t m_paths;
+        std::vector<std::vector<slot_ref> > m_resolved;
+    };
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+#include "succinct/bit_vector.hpp"
+#include "succinct/bp_vector.hpp"
+#include "succinct/elias_fano.hpp"
+#include "succinct/broadword.hpp"
+
+namespace semi_index {
+
+    // Append-only byte buffer that can move its content to an anonymous
+    // temporary file once the in-memory part grows above a threshold
+    class spill_buffer : boost::noncopyable {
+    public:
+        spill_buffer()
+            : m_file(0)
+            , m_spilled(0)
+            , m_spill_threshold(0)
+        {}
+
+        ~spill_buffer() {
+            if (m_file) fclose(m_file);
+        }
+
+        // threshold == 0 disables spilling
+        void spill_to_disk(size_t threshold) {
+            m_spill_threshold = threshold;
+        }
+
+        void put(uint8_t c) {
+            m_buf.push_back(c);
+            if (m_spill_threshold && m_buf.size() >= m_spill_threshold) {
+                flush();
+            }
+        }
+
+        // Variable-byte encoding, 7 bits per byte
+        void put_varint(uint64_t v) {
+            while (v >= 128) {
+                put(uint8_t(v & 127) | 128);
+                v >>= 7;
+            }
+            put(uint8_t(v));
+        }
+
+        uint64_t size() const {
+            return m_spilled + m_buf.size();
+        }
+
+        // Sequential reader; the buffer must not be written while the
+        // reader is in use
+        class reader {
+        public:
+            reader(spill_buffer const& buf)
+                : m_buf(buf)
+                , m_file_left(buf.m_spilled)
+                , m_pos(0)
+            {
+                if (m_buf.m_file) rewind(m_buf.m_file);
+                fill();
+            }
+
+            uint8_t get() {
+                if (m_pos == m_chunk->size()) {
+                    fill();
+                }
+                return (*m_chunk)[m_pos++];
+            }
+
+            uint64_t get_varint() {
+                uint64_t v = 0;
+                size_t shift = 0;
+                uint8_t c;
+                do {
+                    c = get();
+                    v |= uint64_t(c & 127) << shift;
+                    shift += 7;
+                } while (c & 128);
+                return v;
+            }
+
+        private:
+            void fill() {
+                m_pos = 0;
+                if (m_file_left) {
+                    m_file_chunk.resize(std::min(m_file_left, uint64_t(1) << 20));
+                    if (fread(&m_file_chunk[0], 1, m_file_chunk.size(), m_buf.m_file) != m_file_chunk.size()) {
+                        throw std::runtime_error("Error reading spill file");
+                    }
+                    m_file_left -= m_file_chunk.size();
+                    m_chunk = &m_file_chunk;
+                } else {
+                    m_chunk = &m_buf.m_buf;
+                }
+            }
+
+            spill_buffer const& m_buf;
+            uint64_t m_file_left;
+            std::vector<uint8_t> m_file_chunk;
+            const std::vector<uint8_t>* m_chunk;
+            size_t m_pos;
+        };
+
+    private:
+        void flush() {
+            if (!m_file) {
+                m_file = tmpfile();
+                if (!m_file) {
+                    throw std::runtime_error("Cannot create spill file");
+                }
+            }
+            fseek(m_file, 0, SEEK_END);
+            if (fwrite(&m_buf[0], 1, m_buf.size(), m_file) != m_buf.size()) {
+                throw std::runtime_error("Error writing spill file");
+            }
+            m_spilled += m_buf.size();
+            m_buf.clear();
+        }
+
+        FILE* m_file;
+        uint64_t m_spilled;
+        size_t m_spill_threshold;
+        std::vector<uint8_t> m_buf;
+    };
+
+    // Bit sink that stores only the positions of the ones, as
+    // variable-byte encoded gaps, and builds the Elias-Fano
+    // representation at the end without ever materializing the dense
+    // bit vector
+    class positions_builder : boost::noncopyable {
+    public:
+        positions_builder()
+            : m_size(0)
+            , m_next(0)
+            , m_ones(0)
+        {}
+
+        void spill_to_disk(size_t threshold) {
+            m_gaps.spill_to_disk(threshold);
+        }
+
+        void push_back(bool b) {
+            if (b) push_one(m_size);
+            ++m_size;
+        }
+
+        void append_bits(uint64_t bits, size_t len) {
+            if (len < 64) bits &= (uint64_t(1) << len) - 1;
+            unsigned long bit;
+            while (succinct::broadword::lsb(bits, bit)) {
+                push_one(m_size + bit);
+                bits &= bits - 1;
+            }
+            m_size += len;
+        }
+
+        void zero_extend(uint64_t n) {
+            m_size += n;
+        }
+
+        // Appends the bits of other, rebasing its positions
+        void append(positions_builder const& other) {
+            spill_buffer::reader gaps(other.m_gaps);
+            for (uint64_t i = 0; i < other.m_ones; ++i) {
+                uint64_t gap = gaps.get_varint();
+                if (i == 0) {
+                    m_gaps.put_varint(gap + m_size - m_next);
+                } else {
+                    m_gaps.put_varint(gap);
+                }
+            }
+            if (other.m_ones) {
+                m_next = m_size + other.m_next;
+            }
+            m_ones += other.m_ones;
+            m_size += other.m_size;
+        }
+
+        uint64_t size() const {
+            return m_size;
+        }
+
+        uint64_t num_ones() const {
+            return m_ones;
+        }
+
+        void build(succinct::elias_fano& ef, bool with_rank_index = false) const {
+            succinct::elias_fano::elias_fano_builder efb(m_size, m_ones);
+            spill_buffer::reader gaps(m_gaps);
+            uint64_t next = 0;
+            for (uint64_t i = 0; i < m_ones; ++i) {
+                uint64_t pos = next + gaps.get_varint();
+                efb.push_back(pos);
+                next = pos + 1;
+            }
+            succinct::elias_fano(&efb, with_rank_index).swap(ef);
+        }
+
+    private:
+        void push_one(uint64_t pos) {
+            m_gaps.put_varint(pos - m_next);
+            m_next = pos + 1;
+            ++m_ones;
+        }
+
+        uint64_t m_size;
+        uint64_t m_next; // position after the last one
+        uint64_t m_ones;
+        spill_buffer m_gaps;
+    };
+
+    // Bit sink that packs the bits in 64-bit words stored in a
+    // spill_buffer, used for bp
+    class bits_builder : boost::noncopyable {
+    public:
+        bits_builder()
+            : m_size(0)
+            , m_cur(0)
+            , m_cur_len(0)
+        {}
+
+        void spill_to_disk(size_t threshold) {
+            m_words.spill_to_disk(threshold);
+        }
+
+        void push_back(bool b) {
+            append_bits(b, 1);
+        }
+
+        void append_bits(uint64_t bits, size_t len) {
+            if (!len) return;
+            if (len < 64) bits &= (uint64_t(1) << len) - 1;
+            m_cur |= bits << m_cur_len;
+            if (m_cur_len + len >= 64) {
+                write_word(m_cur);
+                size_t used = 64 - m_cur_len;
+                m_cur = (used < 64) ? (bits >> used) : 0;
+                m_cur_len = m_cur_len + len - 64;
+            } else {
+                m_cur_len += len;
+            }
+            m_size += len;
+        }
+
+        void zero_extend(uint64_t n) {
+            for (; n >= 64; n -= 64) append_bits(0, 64);
+            append_bits(0, n);
+        }
+
+        void append(bits_builder const& other) {
+            spill_buffer::reader words(other.m_words);
+            for (uint64_t i = 0; i < other.m_size / 64; ++i) {
+                append_bits(read_word(words), 64);
+            }
+            append_bits(other.m_cur, other.m_cur_len);
+        }
+
+        uint64_t size() const {
+            return m_size;
+        }
+
+        void build(succinct::bit_vector_builder& bvb) const {
+            succinct::bit_vector_builder ret;
+            ret.reserve(m_size);
+            spill_buffer::reader words(m_words);
+            for (uint64_t i = 0; i < m_size / 64; ++i) {
+                ret.append_bits(read_word(words), 64);
+            }
+            ret.append_bits(m_cur, m_cur_len);
+            ret.swap(bvb);
+        }
+
+        void build(succinct::bp_vector& bp) const {
+            succinct::bit_vector_builder bvb;
+            build(bvb);
+            succinct::bp_vector(&bvb, false, false).swap(bp);
+        }
+
+    private:
+        void write_word(uint64_t word) {
+            for (size_t i = 0; i < 8; ++i) {
+                m_words.put(uint8_t(word >> (8 * i)));
+            }
+        }
+
+        static uint64_t read_word(spill_buffer::reader& words) {
+            uint64_t word = 0;
+            for (size_t i = 0; i < 8; ++i) {
+                word |= uint64_t(words.get()) << (8 * i);
+            }
+            return word;
+        }
+
+        uint64_t m_size;
+        uint64_t m_cur;
+        size_t m_cur_len;
+        spill_buffer m_words;
+    };
+}
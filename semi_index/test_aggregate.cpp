@@ -0,0 +1,79 @@
+#define BOOST_TEST_MODULE aggregate
+#include "succinct/test_common.hpp"
+
+#include "aggregate.hpp"
+#include "json_semi_index.hpp"
+
+BOOST_AUTO_TEST_CASE(aggregate_spec)
+{
+    semi_index::aggregate_spec spec = semi_index::parse_aggregate_spec("a.b, c", "count, sum(x),min(l[*].y),max(x),avg(x)");
+    BOOST_REQUIRE_EQUAL(2U, spec.group_names.size());
+    BOOST_CHECK_EQUAL("a.b", spec.group_names[0]);
+    BOOST_CHECK_EQUAL("c", spec.group_names[1]);
+    BOOST_REQUIRE_EQUAL(5U, spec.fns.size());
+    BOOST_CHECK_EQUAL(semi_index::count_fn, spec.fns[0]);
+    BOOST_CHECK_EQUAL(semi_index::min_fn, spec.fns[2]);
+    BOOST_CHECK_EQUAL("min(l[*].y)", spec.names[2]);
+    BOOST_CHECK_EQUAL(6U, spec.trie.num_paths);
+    BOOST_CHECK_EQUAL(3U, spec.fn_paths[2]);
+    BOOST_CHECK(spec.trie.multi_valued[3]);
+
+    BOOST_CHECK_EQUAL(0U, semi_index::parse_aggregate_spec("", "count").group_names.size());
+    BOOST_CHECK_THROW(semi_index::parse_aggregate_spec("a[*]", "count"), std::invalid_argument);
+    BOOST_CHECK_THROW(semi_index::parse_aggregate_spec("a", "median(x)"), std::invalid_argument);
+    BOOST_CHECK_THROW(semi_index::parse_aggregate_spec("a", "sum(x"), std::invalid_argument);
+    BOOST_CHECK_THROW(semi_index::parse_aggregate_spec("a", ""), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(aggregate)
+{
+    using semi_index::json_semi_index;
+    std::string buffer =
+        "{\"k\": \"a\", \"x\": 1, \"l\": [{\"y\": 5}, {\"y\": -2}]}\n"
+        "{\"k\": \"b\", \"x\": 2.5}\n"
+        "{\"k\":\"a\", \"x\": \"str\", \"l\": []}\n"
+        "{\"x\": 4}\n"
+        "{\"k\": \"a\", \"x\": 3}\n"
+        "{\"k\": {\"z\": 1}, \"x\": 1}\n";
+    semi_index::json_semi_index_builder builder;
+    builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index index(&builder);
+
+    semi_index::aggregate_spec spec = semi_index::parse_aggregate_spec("k", "count,sum(x),min(l[*].y),max(x),avg(x)");
+
+    // all the documents in one aggregator, and split between two
+    // aggregators then merged
+    semi_index::aggregator<json_semi_index::accessor> all(spec), left(spec), right(spec);
+    for (size_t i = 0; i < index.num_documents(); ++i) {
+        const char* line = buffer.c_str() + index.get_cursor(i).get_offset();
+        json_semi_index::accessor root = index.get_cursor(i).get_accessor(line);
+        all.add(root, line);
+        (i % 2 ? left : right).add(root, line);
+    }
+    left.merge(right);
+    BOOST_CHECK_EQUAL(4U, all.num_groups());
+    BOOST_CHECK_EQUAL(4U, left.num_groups());
+
+    std::string out, merged;
+    all.write(out);
+    left.write(merged);
+    BOOST_CHECK_EQUAL(out, merged);
+
+    std::string expected =
+        "{\"k\": \"a\", \"count\": 3, \"sum(x)\": 4, \"min(l[*].y)\": -2, \"max(x)\": 3, \"avg(x)\": 2}\n"
+        "{\"k\": \"b\", \"count\": 1, \"sum(x)\": 2.5, \"min(l[*].y)\": null, \"max(x)\": 2.5, \"avg(x)\": 2.5}\n"
+        "{\"k\": null, \"count\": 1, \"sum(x)\": 4, \"min(l[*].y)\": null, \"max(x)\": 4, \"avg(x)\": 4}\n"
+        "{\"k\": {\"z\": 1}, \"count\": 1, \"sum(x)\": 1, \"min(l[*].y)\": null, \"max(x)\": 1, \"avg(x)\": 1}\n";
+    BOOST_CHECK_EQUAL(expected, out);
+
+    // a single group without group-by paths
+    semi_index::aggregate_spec total_spec = semi_index::parse_aggregate_spec("", "count,sum(x)");
+    semi_index::aggregator<json_semi_index::accessor> total(total_spec);
+    for (size_t i = 0; i < index.num_documents(); ++i) {
+        const char* line = buffer.c_str() + index.get_cursor(i).get_offset();
+        total.add(index.get_cursor(i).get_accessor(line), line);
+    }
+    out.clear();
+    total.write(out);
+    BOOST_CHECK_EQUAL("{\"count\": 6, \"sum(x)\": 11.5}\n", out);
+}
@@ -0,0 +1,87 @@
+#define BOOST_TEST_MODULE json_arena
+#include "succinct/test_common.hpp"
+
+#include <sstream>
+
+#include "json_arena.hpp"
+#include "json_spirit_parser.hpp"
+
+namespace {
+    const json::parser::arena_value* parse(std::string const& s, json::parser::arena& a) {
+        return json::parser::parse(s.c_str(), s.c_str() + s.size(), a);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_arena)
+{
+    using json::parser::arena_value;
+    json::parser::arena a(128);
+
+    std::string s = " [{}, 1, 2.5e1, \"bar\", {\"a\": [true, false, null], \"b\\n\": \"x\\\"y\\u00e8\"}, []] ";
+    const arena_value* val = parse(s, a);
+    BOOST_REQUIRE(val);
+    BOOST_REQUIRE_EQUAL(arena_value::array_kind, val->kind);
+    BOOST_REQUIRE_EQUAL(6U, val->size);
+    BOOST_CHECK_EQUAL(arena_value::object_kind, val->elements[0].kind);
+    BOOST_CHECK_EQUAL(0U, val->elements[0].size);
+    BOOST_CHECK_EQUAL(1, val->elements[1].number);
+    BOOST_CHECK_EQUAL(25, val->elements[2].number);
+    BOOST_CHECK_EQUAL("bar", val->elements[3].to_string());
+    // strings without escapes point into the text
+    BOOST_CHECK(val->elements[3].str == s.c_str() + s.find("bar"));
+    BOOST_CHECK_EQUAL(0U, val->elements[5].size);
+
+    arena_value const& obj = val->elements[4];
+    BOOST_REQUIRE_EQUAL(2U, obj.size);
+    BOOST_REQUIRE(obj.find("a"));
+    BOOST_CHECK(!obj.find("b"));
+    BOOST_REQUIRE(obj.find("b\n"));
+    BOOST_CHECK_EQUAL("x\"y\xc3\xa8", obj.find("b\n")->to_string());
+    arena_value const& list = *obj.find("a");
+    BOOST_REQUIRE_EQUAL(3U, list.size);
+    BOOST_CHECK(list.elements[0].boolean);
+    BOOST_CHECK(!list.elements[1].boolean);
+    BOOST_CHECK_EQUAL(arena_value::null_kind, list.elements[2].kind);
+
+    BOOST_CHECK(!parse("{\"a\": }", a));
+    BOOST_CHECK(!parse("[1, 2", a));
+    BOOST_CHECK(!parse("\"abc\\\"", a));
+    BOOST_CHECK(!parse("{} {", a));
+    BOOST_CHECK(!parse("tru", a));
+    BOOST_REQUIRE(parse("\"\\\\\"", a));
+    BOOST_CHECK_EQUAL("\\", parse("\"\\\\\"", a)->to_string());
+}
+
+BOOST_AUTO_TEST_CASE(json_arena_reuse)
+{
+    using json::parser::arena_value;
+    json::parser::arena a(256);
+
+    // after the first rounds, resetting the arena between documents
+    // does not allocate new blocks
+    size_t blocks = 0;
+    for (size_t round = 0; round < 5; ++round) {
+        for (size_t i = 0; i < 100; ++i) {
+            a.reset();
+            std::ostringstream os;
+            os << "{\"id\": " << i << ", \"l\": [";
+            for (size_t j = 0; j < i; ++j) {
+                os << (j ? "," : "") << "{\"k\": \"v\\t" << j << "\"}";
+            }
+            os << "]}";
+            std::string json = os.str(); // the keys point into the text
+            const arena_value* val = parse(json, a);
+            BOOST_REQUIRE(val);
+            BOOST_REQUIRE_EQUAL(double(i), val->find("id")->number);
+            BOOST_REQUIRE_EQUAL(i, val->find("l")->size);
+            if (i) {
+                BOOST_REQUIRE_EQUAL("v\t0", val->find("l")->elements[0].find("k")->to_string());
+            }
+        }
+        if (round == 1) {
+            blocks = a.num_blocks();
+        } else if (round > 1) {
+            BOOST_CHECK_EQUAL(blocks, a.num_blocks());
+        }
+    }
+}
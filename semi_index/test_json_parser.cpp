@@ -0,0 +1,120 @@
+#define BOOST_TEST_MODULE json_parser
+#include "succinct/test_common.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "json_spirit_parser.hpp"
+#include "value_decoder.hpp"
+
+namespace {
+    using namespace json::parser;
+
+    bool equal_values(value const& a, value const& b)
+    {
+        if (a.which() != b.which()) return false;
+        if (const bool* x = boost::get<bool>(&a)) return *x == boost::get<bool>(b);
+        if (const double* x = boost::get<double>(&a)) return *x == boost::get<double>(b);
+        if (const std::string* x = boost::get<std::string>(&a)) return *x == boost::get<std::string>(b);
+        if (const array* x = boost::get<array>(&a)) {
+            array const& y = boost::get<array>(b);
+            if (x->size() != y.size()) return false;
+            for (size_t i = 0; i < x->size(); ++i) {
+                if (!equal_values((*x)[i], y[i])) return false;
+            }
+            return true;
+        }
+        if (const object* x = boost::get<object>(&a)) {
+            object const& y = boost::get<object>(b);
+            if (x->size() != y.size()) return false;
+            for (object::const_iterator it = x->begin(); it != x->end(); ++it) {
+                object::const_iterator other = y.find(it->first);
+                if (other == y.end() || !equal_values(it->second, other->second)) return false;
+            }
+            return true;
+        }
+        return true; // null
+    }
+
+    double number(const char* s)
+    {
+        double value;
+        const char* end = semi_index::detail::parse_number(s, s + strlen(s), value);
+        BOOST_REQUIRE_MESSAGE(end == s + strlen(s), s);
+        return value;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_parser_numbers)
+{
+    const char* exact[] = {
+        "0", "-0", "1", "-1", "0.1", "3.14", "1e22", "1e23", "1E-22", "1e-23",
+        "9007199254740992", "9007199254740993", "18446744073709551615",
+        "123456789012345678901234567890", "0.000000000000000000000000001234",
+        "1.7976931348623157e308", "4.9e-324", "2.2250738585072014e-308",
+        "1e400", "12345.6789e-3", "0.30000000000000004"
+    };
+    for (size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); ++i) {
+        double expected = strtod(exact[i], 0);
+        double value = number(exact[i]);
+        BOOST_CHECK_MESSAGE(memcmp(&expected, &value, sizeof(double)) == 0, exact[i]);
+    }
+
+    srand(42);
+    for (size_t i = 0; i < 100000; ++i) {
+        std::ostringstream os;
+        if (rand() % 2) os << '-';
+        os << rand() % 100000;
+        if (rand() % 2) {
+            os << '.' << std::string(rand() % 3, '0') << rand();
+        }
+        if (rand() % 2) {
+            os << 'e' << (rand() % 2 ? "-" : "") << rand() % 40;
+        }
+        std::string s = os.str();
+        double expected = strtod(s.c_str(), 0);
+        double value = number(s.c_str());
+        BOOST_REQUIRE_MESSAGE(memcmp(&expected, &value, sizeof(double)) == 0, s);
+    }
+
+    const char* invalid[] = { "", "-", "+1", ".5", "1.", "1.e5", "1e", "1e+", "-a" };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        double value;
+        const char* s = invalid[i];
+        const char* end = semi_index::detail::parse_number(s, s + strlen(s), value);
+        BOOST_CHECK_MESSAGE(!end || end != s + strlen(s), s);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_parser)
+{
+    const char* jsons[] = {
+        "{\"a\": [1, 2.5, -3e2, \"x\"], \"b\": {\"c\": null, \"d\": true, \"e\": false}}",
+        " [ ] ",
+        "{}",
+        "\"a long string without escapes, longer than a single vector register\"",
+        "\"escapes \\\" \\\\ \\/ \\b \\f \\n \\r \\t in a string that spans blocks\\\\\"",
+        "{\"dup\": 1, \"dup\": 2}",
+        "[[[[[]]]], {\"\": \"\"}]",
+        "{\"a\" : 1 , \"b\" :[ 1 ,2 ] }",
+    };
+    for (size_t i = 0; i < sizeof(jsons) / sizeof(jsons[0]); ++i) {
+        value v, expected;
+        BOOST_REQUIRE_MESSAGE(spirit_parse(jsons[i], expected), jsons[i]);
+        BOOST_REQUIRE_MESSAGE(parse(jsons[i], v), jsons[i]);
+        BOOST_CHECK_MESSAGE(equal_values(expected, v), jsons[i]);
+    }
+
+    value v;
+    BOOST_REQUIRE(parse("\"\\u00e8\\ud83d\\ude00\"", v));
+    BOOST_CHECK_EQUAL("\xc3\xa8\xf0\x9f\x98\x80", boost::get<std::string>(v));
+    BOOST_REQUIRE(parse("{\"dup\": 1, \"dup\": 2}", v));
+    BOOST_CHECK_EQUAL(2, boost::get<double>(boost::get<object>(v).find("dup")->second));
+
+    const char* invalid[] = { "", "{", "[1,", "{\"a\" 1}", "{\"a\": }", "\"abc", "\"abc\\\"", "tru", "[1 2]" };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        BOOST_CHECK_MESSAGE(!parse(invalid[i], v), invalid[i]);
+    }
+}
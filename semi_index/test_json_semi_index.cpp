@@ -1,6 +1,12 @@
 #define BOOST_TEST_MODULE json_semi_index
 #include "succinct/test_common.hpp"
 
+#include <sstream>
+#include <limits>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
 #include "json_semi_index.hpp"
 
 namespace semi_index {
@@ -15,6 +21,18 @@ namespace semi_index {
             }
             BOOST_CHECK_EQUAL(0, excess);
         }
+
+        static void test_equal(json_semi_index const& a, json_semi_index const& b) {
+            BOOST_REQUIRE_EQUAL(a.m_nav.size(), b.m_nav.size());
+            BOOST_REQUIRE_EQUAL(a.m_nav.num_ones(), b.m_nav.num_ones());
+            for (size_t i = 0; i < a.m_nav.num_ones(); ++i) {
+                BOOST_REQUIRE_EQUAL(a.m_nav.select(i), b.m_nav.select(i));
+            }
+            BOOST_REQUIRE_EQUAL(a.m_bp.size(), b.m_bp.size());
+            for (size_t i = 0; i < a.m_bp.size(); ++i) {
+                BOOST_REQUIRE_EQUAL(a.m_bp[i], b.m_bp[i]);
+            }
+        }
     };
 }
 
@@ -106,6 +124,19 @@ BOOST_AUTO_TEST_CASE(json_semi_index)
     BOOST_CHECK_EQUAL(2.0, get<double>(root.get_path(paths[2]).parse()));
     BOOST_CHECK_EQUAL("{}[]:,\"\\", get<std::string>(root.get_path(paths[3]).parse()));
 
+    json::path::path_list_t trie_paths = json::path::parse("top[4].a,d.a2,d.a1,xx,top[4].xx,top[-2].a,top[4],d.a1,top[5],top.x,,d");
+    json::path::path_trie trie(trie_paths);
+    std::vector<semi_index::json_semi_index::accessor> results;
+    root.get_paths(trie, results);
+    BOOST_REQUIRE_EQUAL(trie_paths.size(), results.size());
+    for (size_t i = 0; i < trie_paths.size(); ++i) {
+        accessor = root.get_path(trie_paths[i]);
+        BOOST_CHECK_EQUAL(accessor.is_valid, results[i].is_valid);
+        if (accessor.is_valid && results[i].is_valid) {
+            BOOST_CHECK(accessor.get_range() == results[i].get_range());
+        }
+    }
+
     cursor = cursor.next();
     root = cursor.get_accessor(jsons[1].c_str());
 
@@ -117,4 +148,522 @@ BOOST_AUTO_TEST_CASE(json_semi_index)
 
     cursor = cursor.next();
     BOOST_CHECK(cursor == semi_index::json_semi_index::cursor());
+
+    BOOST_CHECK_EQUAL(2U, index.num_documents());
+    BOOST_CHECK(index.get_cursor(0) == index.get_cursor());
+    BOOST_CHECK(index.get_cursor(1) == index.get_cursor().next());
+    BOOST_CHECK_EQUAL(jsons[0].size(), index.get_cursor(1).get_offset());
+    BOOST_CHECK_EQUAL(0U, index.document_at(0));
+    BOOST_CHECK_EQUAL(0U, index.document_at(jsons[0].size() - 1));
+    BOOST_CHECK_EQUAL(1U, index.document_at(jsons[0].size()));
+    BOOST_CHECK_EQUAL(1U, index.document_at(jsons[0].size() + jsons[1].size() - 1));
+}
+
+BOOST_AUTO_TEST_CASE(json_scanner)
+{
+    // random documents with nested strings, escapes and all the
+    // structural characters, across 64-byte block boundaries
+    const char* atoms[] = {
+        "{", "}", "[", "]", ",", ":", " ", "1", "null",
+        "\"a\"", "\"{}[]:,\"", "\"\\\"\"", "\"\\\\\"", "\"\\\\\\\"x\"",
+        "\"\\\\\\\\\"", "\"long string without any special characters in it\""
+    };
+    size_t n_atoms = sizeof(atoms) / sizeof(atoms[0]);
+    srand(42);
+
+    for (size_t doc = 0; doc < 1000; ++doc) {
+        std::string json;
+        size_t len = rand() % 300;
+        while (json.size() < len) {
+            json += atoms[rand() % n_atoms];
+        }
+
+        succinct::bit_vector_builder nav_scalar, bp_scalar, nav_simd, bp_simd;
+        semi_index::scan_json_scalar(json.begin(), json.end(), nav_scalar, bp_scalar);
+        semi_index::scan_json_simd(json.c_str(), json.c_str() + json.size(), nav_simd, bp_simd);
+
+        semi_index::positions_builder nav_stream;
+        semi_index::bits_builder bp_stream;
+        semi_index::scan_json_simd(json.c_str(), json.c_str() + json.size(), nav_stream, bp_stream);
+        succinct::elias_fano ef_stream, ef_dense(&nav_scalar, false);
+        nav_stream.build(ef_stream);
+        BOOST_REQUIRE_EQUAL(ef_dense.size(), ef_stream.size());
+        BOOST_REQUIRE_EQUAL(ef_dense.num_ones(), ef_stream.num_ones());
+        for (size_t i = 0; i < ef_dense.num_ones(); ++i) {
+            BOOST_REQUIRE_EQUAL(ef_dense.select(i), ef_stream.select(i));
+        }
+        succinct::bit_vector_builder bp_from_stream;
+        bp_stream.build(bp_from_stream);
+        BOOST_REQUIRE(bp_from_stream.move_bits() == bp_scalar.move_bits());
+
+        BOOST_REQUIRE_EQUAL(json.size(), nav_simd.size());
+        BOOST_REQUIRE_EQUAL(nav_scalar.size(), nav_simd.size());
+        BOOST_REQUIRE_EQUAL(bp_scalar.size(), bp_simd.size());
+        BOOST_REQUIRE_MESSAGE(nav_scalar.move_bits() == nav_simd.move_bits(), "nav differs on " << json);
+        BOOST_REQUIRE_MESSAGE(bp_scalar.move_bits() == bp_simd.move_bits(), "bp differs on " << json);
+    }
+
+    std::string unterminated = std::string(70, ' ') + "\"abc\\\"";
+    succinct::bit_vector_builder nav, bp;
+    BOOST_CHECK_THROW(semi_index::scan_json_simd(unterminated.c_str(), unterminated.c_str() + unterminated.size(), nav, bp),
+                      std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_parallel_build)
+{
+    std::vector<std::string> jsons;
+    std::string buffer;
+    for (size_t i = 0; i < 1000; ++i) {
+        std::ostringstream os;
+        os << "{\"id\": " << i << ", \"list\": [" << i % 7 << ", \"a,b\"], \"s\": \"" << std::string(i % 50, 'x') << "\"}\n";
+        jsons.push_back(os.str());
+        buffer += os.str();
+    }
+    semi_index::json_semi_index serial(jsons);
+
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        semi_index::json_semi_index_builder builder;
+        builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size(), threads);
+        semi_index::json_semi_index parallel(&builder);
+        semi_index::json_semi_index_test_gateway::test_equal(serial, parallel);
+        BOOST_REQUIRE_EQUAL(jsons.size(), parallel.num_documents());
+    }
+
+    semi_index::json_semi_index::cursor cursor = serial.get_cursor();
+    size_t offset = 0;
+    for (size_t i = 0; i < jsons.size(); ++i) {
+        BOOST_REQUIRE(cursor == serial.get_cursor(i));
+        BOOST_REQUIRE_EQUAL(offset, cursor.get_offset());
+        BOOST_REQUIRE_EQUAL(i, serial.document_at(offset + 1));
+        offset += jsons[i].size();
+        cursor = cursor.next();
+    }
+
+    // spilling intermediate streams every few bytes
+    for (size_t threads = 1; threads <= 4; threads *= 4) {
+        semi_index::json_semi_index_builder builder;
+        builder.spill_to_disk(100);
+        builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size(), threads);
+        semi_index::json_semi_index spilled(&builder);
+        semi_index::json_semi_index_test_gateway::test_equal(serial, spilled);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_mapped_build)
+{
+    std::string json_filename = "_test_json_semi_index_mapped.json";
+    std::vector<std::string> jsons;
+    {
+        std::ofstream fout(json_filename.c_str(), std::ios::binary);
+        for (size_t i = 0; i < 100; ++i) {
+            std::ostringstream os;
+            os << "{\"id\": " << i << ", \"v\": [\"" << std::string(2 * (i % 8), '\\') << "\"]}";
+            if (i != 99) os << "\n"; // last line without newline
+            jsons.push_back(os.str());
+            fout << os.str();
+        }
+    }
+    semi_index::json_semi_index serial(jsons);
+
+    {
+        boost::iostreams::mapped_file_source m(json_filename);
+        semi_index::json_semi_index_builder builder;
+        builder.append_mapped(m, 3);
+        semi_index::json_semi_index mapped(&builder);
+        semi_index::json_semi_index_test_gateway::test_equal(serial, mapped);
+    }
+
+    boost::filesystem::remove(json_filename);
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_key_predictor)
+{
+    // mostly homogeneous documents, with some that move the keys around
+    // or nest an object with the same keys where they were predicted
+    std::vector<std::string> jsons;
+    for (size_t i = 0; i < 200; ++i) {
+        std::ostringstream os;
+        if (i % 10 == 3) {
+            os << "{\"x\": {\"a\": -1, \"b\": {\"c\": -2}}, \"b\": {\"c\": " << i << "}, \"a\": " << i << "}";
+        } else if (i % 10 == 7) {
+            os << "{\"a\": " << i << "}";
+        } else {
+            os << "{\"a\": " << i << ", \"x\": [1, {}], \"b\": {\"d\": 0, \"c\": " << i << "}}";
+        }
+        jsons.push_back(os.str());
+    }
+    semi_index::json_semi_index index(jsons);
+
+    json::path::path_list_t paths = json::path::parse("a,b.c,b,x[1],b.d");
+    json::path::path_trie trie(paths);
+    semi_index::key_predictor predictor(trie);
+    std::vector<semi_index::json_semi_index::accessor> results;
+
+    semi_index::json_semi_index::cursor cursor = index.get_cursor();
+    for (size_t i = 0; i < jsons.size(); ++i) {
+        semi_index::json_semi_index::accessor root = cursor.get_accessor(jsons[i].c_str());
+        root.get_paths(trie, results, &predictor);
+        for (size_t p = 0; p < paths.size(); ++p) {
+            semi_index::json_semi_index::accessor expected = root.get_path(paths[p]);
+            BOOST_REQUIRE_EQUAL(expected.is_valid, results[p].is_valid);
+            if (expected.is_valid) {
+                BOOST_REQUIRE(expected.get_range() == results[p].get_range());
+            }
+        }
+        cursor = cursor.next();
+    }
+
+    BOOST_CHECK(predictor.hits() > predictor.misses());
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_key_index)
+{
+    // compact documents, escaped keys, keys also used as values, empty
+    // and nested objects
+    std::string buffer;
+    for (size_t i = 0; i < 300; ++i) {
+        std::ostringstream os;
+        os << "{\"id\":" << i
+           << ",\"k\\\"q\":\"id\",\"o\":{},\"l\":[{\"id\":" << i % 5 << "},\"o\"]";
+        if (i % 3 == 0) os << ",\"n\":{\"a\":{\"id\":" << i << "},\"" << std::string(i % 4, 'b') << "\":1}";
+        os << "}\n";
+        buffer += os.str();
+    }
+
+    semi_index::json_semi_index_builder text_builder;
+    text_builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    semi_index::json_semi_index text(&text_builder);
+    BOOST_REQUIRE(!text.has_key_index());
+
+    json::path::path_list_t paths = json::path::parse("id,o,o.id,l[0].id,l[1].id,n.a.id,n.bb,n.b,n,x,n.a");
+    json::path::path_trie trie(paths);
+
+    for (size_t threads = 1; threads <= 4; threads *= 4) {
+        semi_index::json_semi_index_builder builder;
+        builder.key_index(true);
+        builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size(), threads);
+        semi_index::json_semi_index keys(&builder);
+        BOOST_REQUIRE(keys.has_key_index());
+        semi_index::json_semi_index_test_gateway::test_equal(text, keys);
+
+        std::vector<semi_index::json_semi_index::accessor> results;
+        for (size_t i = 0; i < keys.num_documents(); ++i) {
+            const char* line = buffer.c_str() + keys.get_cursor(i).get_offset();
+            semi_index::json_semi_index::accessor text_root = text.get_cursor(i).get_accessor(line);
+            semi_index::json_semi_index::accessor root = keys.get_cursor(i).get_accessor(line);
+            BOOST_REQUIRE(root["k\"q"].is_valid);
+            root.get_paths(trie, results);
+            for (size_t p = 0; p < paths.size(); ++p) {
+                semi_index::json_semi_index::accessor expected = text_root.get_path(paths[p]);
+                BOOST_REQUIRE_EQUAL(expected.is_valid, results[p].is_valid);
+                BOOST_REQUIRE_EQUAL(expected.is_valid, root.get_path(paths[p]).is_valid);
+                if (expected.is_valid) {
+                    BOOST_REQUIRE(expected.get_range() == results[p].get_range());
+                }
+            }
+        }
+    }
+
+    // keys after the first member of compact objects
+    std::string compact = "{\"a\":1,\"b\":2,\"c\":{\"d\":3}}";
+    semi_index::json_semi_index index(std::vector<std::string>(1, compact));
+    semi_index::json_semi_index::accessor root = index.get_cursor().get_accessor(compact.c_str());
+    BOOST_REQUIRE(root["b"].is_valid);
+    BOOST_CHECK_EQUAL(compact.substr(root["c"]["d"].get_pos(), 1), "3");
+
+    // the members after a scalar are not its children
+    std::vector<std::string> scalars;
+    scalars.push_back("{\"a\":1,\"b\":2}");
+    scalars.push_back("{\"a\":\"x\",\"b\":{\"c\":3}}");
+    semi_index::json_semi_index_builder scalars_builder;
+    scalars_builder.key_index(true);
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        std::string line = scalars[i] + "\n";
+        scalars_builder.append_lines(line.c_str(), line.c_str() + line.size());
+    }
+    semi_index::json_semi_index scalars_index(&scalars_builder);
+    BOOST_REQUIRE(scalars_index.has_key_index());
+    json::path::path_list_t scalar_paths = json::path::parse("a.b,a.b.c,b");
+    json::path::path_trie scalar_trie(scalar_paths);
+    std::vector<semi_index::json_semi_index::accessor> scalar_results;
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        semi_index::json_semi_index::accessor scalar_root =
+            scalars_index.get_cursor(i).get_accessor(scalars[i].c_str());
+        BOOST_CHECK(!scalar_root["a"]["b"].is_valid);
+        BOOST_CHECK(!scalar_root.get_path(scalar_paths[1]).is_valid);
+        scalar_root.get_paths(scalar_trie, scalar_results);
+        BOOST_CHECK(!scalar_results[0].is_valid);
+        BOOST_CHECK(!scalar_results[1].is_valid);
+        BOOST_CHECK(scalar_results[2].is_valid);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_typed_accessors)
+{
+    using semi_index::json_semi_index;
+    std::string json = "{\"i\": -42 , \"big\":9223372036854775807,\"small\":-9223372036854775808,"
+        "\"over\":9223372036854775808,\"d\":\t1.5e3\n,\"t\":true,\"f\": false,\"n\":null,"
+        "\"s\": \"plain\" ,\"e\":\"a\\\"b\\\\c\\n\\u00e8\\u20ac\\ud83d\\ude00\",\"empty\":\"\","
+        "\"a\":[1, \"x\"],\"o\":{}}";
+    json_semi_index index(std::vector<std::string>(1, json));
+    json_semi_index::accessor root = index.get_cursor().get_accessor(json.c_str());
+
+    BOOST_CHECK_EQUAL(semi_index::object_type, root.type());
+    BOOST_CHECK_EQUAL(semi_index::number_type, root["i"].type());
+    BOOST_CHECK_EQUAL(semi_index::bool_type, root["f"].type());
+    BOOST_CHECK_EQUAL(semi_index::null_type, root["n"].type());
+    BOOST_CHECK_EQUAL(semi_index::string_type, root["s"].type());
+    BOOST_CHECK_EQUAL(semi_index::array_type, root["a"].type());
+    BOOST_CHECK_EQUAL(semi_index::object_type, root["o"].type());
+    BOOST_CHECK_EQUAL(semi_index::invalid_type, root["missing"].type());
+
+    BOOST_CHECK_EQUAL(-42, root["i"].as_int64());
+    BOOST_CHECK_EQUAL(-42.0, root["i"].as_double());
+    BOOST_CHECK_EQUAL(std::numeric_limits<int64_t>::max(), root["big"].as_int64());
+    BOOST_CHECK_EQUAL(std::numeric_limits<int64_t>::min(), root["small"].as_int64());
+    BOOST_CHECK_THROW(root["over"].as_int64(), std::out_of_range);
+    BOOST_CHECK_THROW(root["d"].as_int64(), std::invalid_argument);
+    BOOST_CHECK_EQUAL(1500.0, root["d"].as_double());
+    BOOST_CHECK_EQUAL(1500.0, boost::get<double>(root["d"].parse()));
+    // numbers longer than the local buffer
+    std::string long_json = "{\"x\":0." + std::string(70, '0') + "1,\"y\":" + std::string(80, '1') + "x}";
+    json_semi_index long_index(std::vector<std::string>(1, long_json));
+    json_semi_index::accessor long_root = long_index.get_cursor().get_accessor(long_json.c_str());
+    BOOST_CHECK_CLOSE(1e-71, long_root["x"].as_double(), 1e-9);
+    BOOST_CHECK_THROW(long_root["y"].as_double(), std::invalid_argument);
+    BOOST_CHECK_EQUAL(1, root["a"][0].as_int64());
+
+    BOOST_CHECK(root["t"].as_bool());
+    BOOST_CHECK(!root["f"].as_bool());
+    BOOST_CHECK(root["n"].is_null());
+    BOOST_CHECK(!root["s"].is_null());
+    BOOST_CHECK_THROW(root["n"].as_bool(), std::invalid_argument);
+    BOOST_CHECK_THROW(root["i"].as_raw_string(), std::invalid_argument);
+
+    std::pair<const char*, const char*> raw = root["e"].as_raw_string();
+    BOOST_CHECK_EQUAL("a\\\"b\\\\c\\n\\u00e8\\u20ac\\ud83d\\ude00", std::string(raw.first, raw.second));
+
+    std::string buffer;
+    semi_index::string_view_t s = root["s"].as_unescaped_string(buffer);
+    BOOST_CHECK_EQUAL("plain", std::string(s.first, s.second));
+    BOOST_CHECK(s.first > json.c_str() && s.second < json.c_str() + json.size()); // not copied
+    s = root["a"][1].as_unescaped_string(buffer);
+    BOOST_CHECK_EQUAL("x", std::string(s.first, s.second));
+    s = root["empty"].as_unescaped_string(buffer);
+    BOOST_CHECK(s.first == s.second);
+    s = root["e"].as_unescaped_string(buffer);
+    BOOST_CHECK_EQUAL("a\"b\\c\n\xc3\xa8\xe2\x82\xac\xf0\x9f\x98\x80", std::string(s.first, s.second));
+
+    json::parser::arena a;
+    json::parser::arena_value const& list = root["a"].parse(a);
+    BOOST_REQUIRE_EQUAL(json::parser::arena_value::array_kind, list.kind);
+    BOOST_REQUIRE_EQUAL(2U, list.size);
+    BOOST_CHECK_EQUAL(1, list.elements[0].number);
+    BOOST_CHECK_EQUAL("x", list.elements[1].to_string());
+    BOOST_CHECK_EQUAL(root.parse(a).size, 13U);
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_children)
+{
+    using semi_index::json_semi_index;
+    std::string json = "{\"empty\": [], \"blank\": [ ], \"one\": [1], \"one_obj\": [{}],"
+        "\"list\": [1, \"a,b\", [2, 3], {\"x\": {}}, null],"
+        "\"o\": { }, \"obj\": {\"a\": 1, \"b\\\"\": [], \"c\": {\"d\": 2}}, \"s\": \"[1, 2]\"}";
+    json_semi_index index(std::vector<std::string>(1, json));
+    json_semi_index::accessor root = index.get_cursor().get_accessor(json.c_str());
+
+    BOOST_CHECK_EQUAL(8U, root.size());
+    BOOST_CHECK_EQUAL(0U, root["empty"].size());
+    BOOST_CHECK_EQUAL(0U, root["blank"].size());
+    BOOST_CHECK_EQUAL(1U, root["one"].size());
+    BOOST_CHECK_EQUAL(1U, root["one_obj"].size());
+    BOOST_CHECK_EQUAL(5U, root["list"].size());
+    BOOST_CHECK_EQUAL(0U, root["o"].size());
+    BOOST_CHECK(!root["o"]["s"].is_valid);
+    BOOST_CHECK_EQUAL(3U, root["obj"].size());
+    BOOST_CHECK_EQUAL(0U, root["s"].size());
+    BOOST_CHECK_EQUAL(0U, root["list"][0].size());
+    BOOST_CHECK_EQUAL(0U, root["missing"].size());
+
+    const char* arrays[] = { "empty", "blank", "one", "one_obj", "list" };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i) {
+        json_semi_index::accessor array = root[arrays[i]];
+        size_t n = 0;
+        BOOST_FOREACH(json_semi_index::accessor const& element, array.children()) {
+            BOOST_REQUIRE(array[n].is_valid);
+            BOOST_REQUIRE(array[n].get_range() == element.get_range());
+            ++n;
+        }
+        BOOST_CHECK(!array[n].is_valid);
+        BOOST_CHECK_EQUAL(array.size(), n);
+    }
+    BOOST_CHECK(root["s"].children().first == root["s"].children().second);
+
+    std::vector<std::string> keys;
+    std::string buffer;
+    BOOST_FOREACH(json_semi_index::member const& m, root["obj"].members()) {
+        semi_index::string_view_t key = m.key.as_unescaped_string(buffer);
+        keys.push_back(std::string(key.first, key.second));
+        BOOST_REQUIRE(root["obj"][keys.back()].get_range() == m.value.get_range());
+    }
+    BOOST_REQUIRE_EQUAL(3U, keys.size());
+    BOOST_CHECK_EQUAL("a", keys[0]);
+    BOOST_CHECK_EQUAL("b\"", keys[1]);
+    BOOST_CHECK_EQUAL("c", keys[2]);
+    BOOST_CHECK(root["o"].members().first == root["o"].members().second);
+    BOOST_CHECK(root["list"].members().first == root["list"].members().second);
+
+    size_t n = 0;
+    BOOST_FOREACH(json_semi_index::member const& m, root.members()) {
+        (void)m;
+        ++n;
+    }
+    BOOST_CHECK_EQUAL(root.size(), n);
+}
+
+namespace {
+    // Text of the value without the surrounding whitespace
+    std::string value_text(const char* line, semi_index::json_semi_index::accessor const& value)
+    {
+        semi_index::json_semi_index::accessor::range_t r = value.get_range();
+        size_t begin = semi_index::detail::skip_space(line, r.first, r.second);
+        size_t end = semi_index::detail::trim_space(line, begin, r.second);
+        return std::string(line + begin, line + end);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_multi_valued_paths)
+{
+    using semi_index::json_semi_index;
+    std::string buffer =
+        "{\"r\": [{\"t\": 1, \"id\": 10}, {\"t\": 2}, {\"x\": {\"id\": 11}, \"t\": 3}], \"id\": 12, \"o\": {\"a\": 1, \"b\": [2]}}\n"
+        "{\"r\": [ ], \"id\": {\"id\": 13}, \"o\": { }}\n"
+        "{\"r\": {\"t\": 4}, \"l\": [[{\"id\": 14}], \"id\"]}\n";
+
+    // matches of each path, space separated, for each document
+    json::path::path_list_t paths = json::path::parse("r[*].t,r[1:],r[-2:],r[:-1].t,r[5:],o.*,*.t,..id,r[0].id,id,r[*].x..id,l[0][*]");
+    const char* expected[][12] = {
+        { "1 2 3", "{\"t\": 2} {\"x\": {\"id\": 11}, \"t\": 3}", "{\"t\": 2} {\"x\": {\"id\": 11}, \"t\": 3}",
+          "1 2", "", "1 [2]", "", "10 11 12", "10", "12", "11", "" },
+        { "", "", "", "", "", "", "", "{\"id\": 13} 13", "", "{\"id\": 13}", "", "" },
+        { "", "", "", "", "", "", "4", "14", "", "", "", "{\"id\": 14}" },
+    };
+    json::path::path_trie trie(paths);
+
+    for (size_t with_keys = 0; with_keys < 2; ++with_keys) {
+        semi_index::json_semi_index_builder builder;
+        builder.key_index(with_keys != 0);
+        builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+        json_semi_index index(&builder);
+
+        std::vector<json_semi_index::accessor> results;
+        std::vector<json_semi_index::path_match> matches;
+        for (size_t i = 0; i < index.num_documents(); ++i) {
+            const char* line = buffer.c_str() + index.get_cursor(i).get_offset();
+            json_semi_index::accessor root = index.get_cursor(i).get_accessor(line);
+            root.get_paths(trie, results, matches);
+
+            std::vector<std::string> found(paths.size());
+            for (size_t p = 0; p < paths.size(); ++p) {
+                if (!trie.multi_valued[p] && results[p].is_valid) {
+                    found[p] = value_text(line, results[p]);
+                }
+            }
+            for (size_t m = 0; m < matches.size(); ++m) {
+                BOOST_REQUIRE(trie.multi_valued[matches[m].first]);
+                BOOST_REQUIRE(m == 0 || matches[m - 1].first <= matches[m].first);
+                std::string& f = found[matches[m].first];
+                if (!f.empty()) f += ' ';
+                f += value_text(line, matches[m].second);
+            }
+            for (size_t p = 0; p < paths.size(); ++p) {
+                BOOST_CHECK_EQUAL(expected[i][p], found[p]);
+            }
+
+            // the first match without the matches list, and with get_path
+            root.get_paths(trie, results);
+            for (size_t p = 0; p < paths.size(); ++p) {
+                std::string first = found[p].substr(0, found[p].find(' '));
+                BOOST_REQUIRE_EQUAL(!found[p].empty(), results[p].is_valid);
+                BOOST_REQUIRE_EQUAL(!found[p].empty(), root.get_path(paths[p]).is_valid);
+                if (results[p].is_valid && first[0] != '{') {
+                    BOOST_CHECK_EQUAL(first, value_text(line, results[p]));
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_semi_index_array_index)
+{
+    using semi_index::json_semi_index;
+    const size_t sizes[] = { 0, 1, 127, 128, 129, 1000 };
+    std::ostringstream os;
+    for (size_t d = 0; d < 2; ++d) {
+        os << "{\"pad\": [1, 2], ";
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            os << "\"a" << sizes[s] << "\": [ ";
+            for (size_t i = 0; i < sizes[s]; ++i) {
+                if (i) os << ", ";
+                if (i % 3 == 0) os << "[" << i << ", {\"x\": " << i << "}]";
+                else os << i;
+            }
+            os << "], ";
+        }
+        os << "\"o\": {";
+        for (size_t i = 0; i < 300; ++i) {
+            if (i) os << ",";
+            os << "\"k" << i << "\":" << i;
+        }
+        os << "}}\n";
+    }
+    std::string buffer = os.str();
+
+    semi_index::json_semi_index_builder plain_builder;
+    plain_builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index plain(&plain_builder);
+    BOOST_REQUIRE(!plain.has_array_index());
+
+    semi_index::json_semi_index_builder builder;
+    builder.array_index(true);
+    builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index index(&builder);
+    BOOST_REQUIRE(index.has_array_index());
+    semi_index::json_semi_index_test_gateway::test_equal(plain, index);
+
+    json::path::path_list_t paths = json::path::parse("a1000[*],a1000[100:200],a1000[-50:],a129[127:],a128[:-127],a1000[5000:],o.*");
+    json::path::path_trie trie(paths);
+    std::vector<json_semi_index::accessor> results, plain_results;
+    std::vector<json_semi_index::path_match> matches, plain_matches;
+
+    for (size_t d = 0; d < index.num_documents(); ++d) {
+        const char* line = buffer.c_str() + index.get_cursor(d).get_offset();
+        json_semi_index::accessor root = index.get_cursor(d).get_accessor(line);
+        json_semi_index::accessor plain_root = plain.get_cursor(d).get_accessor(line);
+
+        BOOST_CHECK_EQUAL(300U, root["o"].size());
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            std::ostringstream key;
+            key << "a" << sizes[s];
+            json_semi_index::accessor array = root[key.str()];
+            json_semi_index::accessor plain_array = plain_root[key.str()];
+            BOOST_REQUIRE_EQUAL(sizes[s], array.size());
+            int64_t n = sizes[s];
+            for (int64_t i = -n - 2; i < n + 2; ++i) {
+                BOOST_REQUIRE_EQUAL(plain_array[i].is_valid, array[i].is_valid);
+                if (array[i].is_valid) {
+                    BOOST_REQUIRE(plain_array[i].get_range() == array[i].get_range());
+                }
+            }
+        }
+
+        root.get_paths(trie, results, matches);
+        plain_root.get_paths(trie, plain_results, plain_matches);
+        BOOST_REQUIRE_EQUAL(plain_matches.size(), matches.size());
+        for (size_t m = 0; m < matches.size(); ++m) {
+            BOOST_REQUIRE_EQUAL(plain_matches[m].first, matches[m].first);
+            BOOST_REQUIRE(plain_matches[m].second.get_range() == matches[m].second.get_range());
+        }
+        BOOST_CHECK_EQUAL(1000U + 100U + 50U + 2U + 1U + 300U, matches.size());
+    }
 }
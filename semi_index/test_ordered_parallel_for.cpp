@@ -0,0 +1,53 @@
+#define BOOST_TEST_MODULE ordered_parallel_for
+#include "succinct/test_common.hpp"
+
+#include <sstream>
+
+#include "ordered_parallel_for.hpp"
+
+namespace {
+    struct print_task {
+        void operator()(size_t /* thread */, size_t i, std::string& out) {
+            std::ostringstream os;
+            // uneven task lengths to shuffle the completion order
+            for (size_t j = 0; j < (i * 7919) % 101; ++j) {
+                os << i << ",";
+            }
+            out = os.str();
+        }
+    };
+
+    struct concat_sink {
+        void operator()(std::string const& out) {
+            m_out += out;
+        }
+        std::string m_out;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(ordered_parallel_for)
+{
+    print_task task;
+    concat_sink serial;
+    for (size_t i = 0; i < 1000; ++i) {
+        std::string out;
+        task(0, i, out);
+        serial(out);
+    }
+
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        concat_sink parallel;
+        semi_index::ordered_parallel_for(1000, threads, task, parallel);
+        BOOST_CHECK(serial.m_out == parallel.m_out);
+    }
+
+    // more threads than tasks
+    concat_sink few;
+    semi_index::ordered_parallel_for(2, 8, task, few);
+    std::string expected, out;
+    task(0, 0, out);
+    expected += out;
+    task(0, 1, out);
+    expected += out;
+    BOOST_CHECK(expected == few.m_out);
+}
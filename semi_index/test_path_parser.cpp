@@ -20,3 +20,101 @@ BOOST_AUTO_TEST_CASE(path_parser)
     path = paths[3];
     BOOST_CHECK_EQUAL("abc", get<std::string>(path[0]));
 }
+
+BOOST_AUTO_TEST_CASE(path_trie)
+{
+    json::path::path_list_t paths = json::path::parse("a.b,a.c,a,d[1],d[-1].x,a.b");
+    json::path::path_trie trie(paths);
+    BOOST_CHECK_EQUAL(6U, trie.num_paths);
+    // root, a, a.b, a.c, d, d[1], d[-1], d[-1].x
+    BOOST_CHECK_EQUAL(8U, trie.nodes.size());
+
+    json::path::path_trie::node const& root = trie.nodes[0];
+    BOOST_REQUIRE_EQUAL(2U, root.keys.size());
+    BOOST_CHECK_EQUAL("a", root.keys[0].first);
+    BOOST_CHECK_EQUAL("d", root.keys[1].first);
+    BOOST_CHECK(root.paths.empty());
+
+    json::path::path_trie::node const& a = trie.nodes[root.keys[0].second];
+    BOOST_CHECK_EQUAL(2U, a.keys.size());
+    BOOST_REQUIRE_EQUAL(1U, a.paths.size());
+    BOOST_CHECK_EQUAL(2U, a.paths[0]);
+
+    json::path::path_trie::node const& ab = trie.nodes[a.keys[0].second];
+    BOOST_REQUIRE_EQUAL(2U, ab.paths.size());
+    BOOST_CHECK_EQUAL(0U, ab.paths[0]);
+    BOOST_CHECK_EQUAL(5U, ab.paths[1]);
+
+    json::path::path_trie::node const& d = trie.nodes[root.keys[1].second];
+    BOOST_REQUIRE_EQUAL(2U, d.indices.size());
+    BOOST_CHECK_EQUAL(1, d.indices[0].first);
+    BOOST_CHECK_EQUAL(-1, d.indices[1].first);
+}
+
+BOOST_AUTO_TEST_CASE(path_parser_multi_valued)
+{
+    using boost::get;
+    using json::path::slice_t;
+    json::path::path_list_t paths = json::path::parse("a[*].b,a[1:-1],a[:2][0],*.x,..id,a..b[2:],[*],a*b,a.b[3]");
+    BOOST_REQUIRE_EQUAL(9U, paths.size());
+
+    json::path::path_t path = paths[0];
+    BOOST_REQUIRE_EQUAL(3U, path.size());
+    BOOST_CHECK_EQUAL("a", get<std::string>(path[0]));
+    BOOST_CHECK(get<slice_t>(path[1]) == slice_t());
+    BOOST_CHECK_EQUAL("b", get<std::string>(path[2]));
+
+    path = paths[1];
+    BOOST_REQUIRE_EQUAL(2U, path.size());
+    BOOST_CHECK(get<slice_t>(path[1]) == slice_t(1, -1));
+
+    path = paths[2];
+    BOOST_REQUIRE_EQUAL(3U, path.size());
+    BOOST_CHECK(get<slice_t>(path[1]) == slice_t(boost::none, 2));
+    BOOST_CHECK_EQUAL(0, get<int>(path[2]));
+
+    path = paths[3];
+    BOOST_REQUIRE_EQUAL(2U, path.size());
+    BOOST_CHECK(get<json::path::any_key_t>(&path[0]));
+    BOOST_CHECK_EQUAL("x", get<std::string>(path[1]));
+
+    path = paths[4];
+    BOOST_REQUIRE_EQUAL(1U, path.size());
+    BOOST_CHECK_EQUAL("id", get<json::path::descendant_t>(path[0]).key);
+
+    path = paths[5];
+    BOOST_REQUIRE_EQUAL(3U, path.size());
+    BOOST_CHECK_EQUAL("a", get<std::string>(path[0]));
+    BOOST_CHECK_EQUAL("b", get<json::path::descendant_t>(path[1]).key);
+    BOOST_CHECK(get<slice_t>(path[2]) == slice_t(2, boost::none));
+
+    path = paths[6];
+    BOOST_REQUIRE_EQUAL(1U, path.size());
+    BOOST_CHECK(get<slice_t>(path[0]) == slice_t());
+
+    path = paths[7];
+    BOOST_REQUIRE_EQUAL(1U, path.size());
+    BOOST_CHECK_EQUAL("a*b", get<std::string>(path[0]));
+
+    for (size_t i = 0; i < 7; ++i) {
+        BOOST_CHECK(json::path::is_multi_valued(paths[i]));
+    }
+    BOOST_CHECK(!json::path::is_multi_valued(paths[7]));
+    BOOST_CHECK(!json::path::is_multi_valued(paths[8]));
+
+    json::path::path_trie trie(paths);
+    BOOST_REQUIRE_EQUAL(9U, trie.multi_valued.size());
+    BOOST_CHECK(trie.multi_valued[0]);
+    BOOST_CHECK(!trie.multi_valued[8]);
+    json::path::path_trie::node const& root = trie.nodes[0];
+    BOOST_CHECK(root.any_key != 0);
+    BOOST_REQUIRE_EQUAL(1U, root.descendants.size());
+    BOOST_CHECK_EQUAL("id", root.descendants[0].first);
+    BOOST_CHECK_EQUAL(1U, root.slices.size());
+    json::path::path_trie::node const& a = trie.nodes[root.keys[0].second];
+    BOOST_CHECK_EQUAL(3U, a.slices.size());
+    BOOST_CHECK_EQUAL(1U, a.descendants.size());
+
+    BOOST_CHECK_THROW(json::path::parse("a[1:2:3]"), std::invalid_argument);
+    BOOST_CHECK_THROW(json::path::parse("a...b"), std::invalid_argument);
+}
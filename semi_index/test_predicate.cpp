@@ -0,0 +1,90 @@
+#define BOOST_TEST_MODULE predicate
+#include "succinct/test_common.hpp"
+
+#include "predicate.hpp"
+#include "json_semi_index.hpp"
+
+BOOST_AUTO_TEST_CASE(predicate_parser)
+{
+    using json::predicate::expression;
+    json::predicate::expression expr = json::predicate::parse("a.b == \"x\\\"y\" and (c[0] > -1.5e2 or not d!=null)");
+    BOOST_REQUIRE_EQUAL(3U, expr.comparisons.size());
+    BOOST_REQUIRE_EQUAL(6U, expr.nodes.size());
+
+    expression::node const& root = expr.nodes[expr.root];
+    BOOST_CHECK_EQUAL(expression::node::and_kind, root.kind);
+    BOOST_CHECK_EQUAL(expression::node::comparison_kind, expr.nodes[root.left].kind);
+    BOOST_CHECK_EQUAL(expression::node::or_kind, expr.nodes[root.right].kind);
+
+    json::predicate::comparison_t const& b = expr.comparisons[0];
+    BOOST_CHECK_EQUAL(2U, b.path.size());
+    BOOST_CHECK_EQUAL(json::predicate::op_eq, b.op);
+    BOOST_CHECK_EQUAL(json::predicate::literal_t::string_kind, b.value.kind);
+    BOOST_CHECK_EQUAL("x\\\"y", b.value.raw);
+    BOOST_CHECK_EQUAL("x\"y", b.value.str);
+
+    json::predicate::comparison_t const& c = expr.comparisons[1];
+    BOOST_CHECK_EQUAL(json::predicate::op_gt, c.op);
+    BOOST_CHECK_EQUAL(-150.0, c.value.number);
+
+    json::predicate::comparison_t const& d = expr.comparisons[2];
+    BOOST_CHECK_EQUAL(json::predicate::op_ne, d.op);
+    BOOST_CHECK_EQUAL(json::predicate::literal_t::null_kind, d.value.kind);
+
+    BOOST_CHECK(json::predicate::parse("  ").empty());
+    BOOST_CHECK(!json::predicate::parse("notes==true").empty());
+    BOOST_CHECK_THROW(json::predicate::parse("a < \"x\""), std::invalid_argument);
+    BOOST_CHECK_THROW(json::predicate::parse("a = 1"), std::invalid_argument);
+    BOOST_CHECK_THROW(json::predicate::parse("a == 1 and"), std::invalid_argument);
+    BOOST_CHECK_THROW(json::predicate::parse("(a == 1"), std::invalid_argument);
+    BOOST_CHECK_THROW(json::predicate::parse("a == \"x"), std::invalid_argument);
+    BOOST_CHECK_THROW(json::predicate::parse("a,b == 1"), std::invalid_argument);
+    BOOST_CHECK_THROW(json::predicate::parse("== 1"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(predicate_evaluate)
+{
+    using semi_index::json_semi_index;
+    std::string buffer =
+        "{\"action\": \"delete\", \"id\": 1001, \"tags\": [\"a\", \"b\"], \"flag\": true}\n"
+        "{\"action\": \"edit\", \"id\": 5, \"tags\": [], \"flag\": false, \"x\": null}\n"
+        "{\"action\": \"del\\u0065te\", \"id\": \"1001\", \"tags\": [\"b\"]}\n"
+        "{\"action\": \"delete\", \"id\": 2000.5, \"u\": {\"n\": \"\\u00e8\"}}\n";
+
+    const char* cases[][2] = {
+        { "", "1111" },
+        { "action == \"delete\"", "1011" },
+        { "action == \"delete\" and id > 1000", "1001" },
+        { "action != \"delete\"", "0100" },
+        { "id >= 5 and id <= 1001", "1100" },
+        { "id == \"1001\" or flag == false", "0110" },
+        { "not (id < 1000) and action == \"delete\"", "1011" },
+        { "tags[*] == \"b\"", "1010" },
+        { "tags[*] != \"a\"", "1111" },
+        { "missing == 1", "0000" },
+        { "missing != 1", "1111" },
+        { "x == null", "0100" },
+        { "flag == true or flag == false", "1100" },
+        { "u.n == \"\\u00e8\"", "0001" },
+        { "u.n == \"\xc3\xa8\"", "0001" },
+        { "..n == \"\xc3\xa8\" or id < 10", "0101" },
+    };
+
+    semi_index::json_semi_index_builder builder;
+    builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index lines(&builder);
+    BOOST_REQUIRE_EQUAL(4U, lines.num_documents());
+
+    std::vector<json_semi_index::accessor> values;
+    std::vector<json_semi_index::path_match> matches;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        json::predicate::expression expr = json::predicate::parse(cases[c][0]);
+        std::string result;
+        for (size_t i = 0; i < lines.num_documents(); ++i) {
+            const char* line = buffer.c_str() + lines.get_cursor(i).get_offset();
+            json_semi_index::accessor root = lines.get_cursor(i).get_accessor(line);
+            result += json::predicate::evaluate(expr, root, values, matches) ? '1' : '0';
+        }
+        BOOST_CHECK_MESSAGE(result == cases[c][1], cases[c][0] << ": " << result);
+    }
+}
@@ -0,0 +1,58 @@
+#define BOOST_TEST_MODULE shape_index
+#include "succinct/test_common.hpp"
+
+#include "shape_index.hpp"
+#include "json_semi_index.hpp"
+
+BOOST_AUTO_TEST_CASE(shape_index)
+{
+    using semi_index::json_semi_index;
+    std::string buffer =
+        "{\"a\": 1, \"b\": {\"c\": [1, 2, 3]}, \"d\": \"x,}\"}\n"
+        "{\"a\": 22, \"b\": {\"c\": [4, 5, 6]}, \"d\": \"yy\"}\n"
+        "\n"
+        "{\"a\": 3, \"b\": {\"c\": []}, \"d\": null}\n"
+        "{\"a\": 4, \"b\": {\"c\": [7]}, \"d\": \"z\"}\n"
+        " { \"b\" : { \"c\" : [ [8], {\"e\": 9} ] } ,\"a\":[] }\n"
+        "{\"a\": 1, \"b\": {\"c\": [1, 2, 3]}, \"d\": \"w\"}\n"
+        "{\"a\\u0062\": 1, \"a\\\"\": 2, \"a\": 3, \"a\": 4}\n"
+        "[1, {\"a\": 2}, [], [3, [4]]]\n";
+    semi_index::json_semi_index_builder builder;
+    builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index index(&builder);
+
+    semi_index::shape_index_builder shapes_builder;
+    shapes_builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    BOOST_CHECK_EQUAL(6U, shapes_builder.num_shapes());
+    semi_index::shape_index shapes(shapes_builder);
+    BOOST_REQUIRE_EQUAL(index.num_documents(), shapes.num_documents());
+    BOOST_CHECK_EQUAL(6U, shapes.num_shapes());
+    BOOST_CHECK_EQUAL(shapes.shape_id(0), shapes.shape_id(1));
+    BOOST_CHECK_EQUAL(shapes.shape_id(0), shapes.shape_id(5));
+
+    // the ranges must be those of the semi-index
+    json::path::path_list_t paths =
+        json::path::parse(",a,b,b.c,b.c[0],b.c[2],b.c[-1],b.c[3],b.c[1].e,b.c[0][0],d,a\\\",[1].a,[3][1][0],[-2],[4],x");
+    semi_index::shape_path_resolver resolver(shapes, paths);
+    json::path::path_trie trie(paths);
+    std::vector<json_semi_index::accessor> values;
+    for (size_t doc = 0; doc < index.num_documents(); ++doc) {
+        const char* line = buffer.c_str() + index.get_cursor(doc).get_offset();
+        json_semi_index::accessor root = index.get_cursor(doc).get_accessor(line);
+        root.get_paths(trie, values);
+        size_t offset = line - buffer.c_str();
+        for (size_t p = 0; p < paths.size(); ++p) {
+            semi_index::shape_index::range_t r;
+            bool found = resolver.get_range(doc, p, r);
+            BOOST_CHECK_MESSAGE(found == values[p].is_valid, "doc " << doc << " path " << p);
+            if (found && values[p].is_valid) {
+                json_semi_index::accessor::range_t expected = values[p].get_range();
+                BOOST_CHECK_EQUAL(expected.first + offset, r.first);
+                BOOST_CHECK_EQUAL(expected.second + offset, r.second);
+            }
+        }
+    }
+
+    BOOST_CHECK_THROW(semi_index::shape_path_resolver(shapes, json::path::parse("b.c[*]")),
+                      std::invalid_argument);
+}
@@ -0,0 +1,113 @@
+#define BOOST_TEST_MODULE value_index
+#include "succinct/test_common.hpp"
+
+#include "value_index.hpp"
+#include "json_semi_index.hpp"
+
+namespace {
+
+    void build_value_index(semi_index::json_semi_index const& index, std::string const& buffer,
+                           std::string const& path, semi_index::value_index& vi)
+    {
+        semi_index::value_index_builder builder(path);
+        for (size_t i = 0; i < index.num_documents(); ++i) {
+            const char* line = buffer.c_str() + index.get_cursor(i).get_offset();
+            builder.add(index.get_cursor(i).get_accessor(line), line);
+        }
+        semi_index::value_index(builder).swap(vi);
+    }
+
+    semi_index::value_condition condition(semi_index::value_index const& index, std::string const& values)
+    {
+        semi_index::value_condition cond;
+        cond.index = &index;
+        cond.values = semi_index::parse_value_list(values);
+        return cond;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(value_list)
+{
+    std::vector<std::string> values = semi_index::parse_value_list(" 1, \"a,b\" ,\"c\\\",\",null");
+    BOOST_REQUIRE_EQUAL(4U, values.size());
+    BOOST_CHECK_EQUAL("1", values[0]);
+    BOOST_CHECK_EQUAL("\"a,b\"", values[1]);
+    BOOST_CHECK_EQUAL("\"c\\\",\"", values[2]);
+    BOOST_CHECK_EQUAL("null", values[3]);
+
+    BOOST_CHECK_THROW(semi_index::parse_value_list("1,,2"), std::invalid_argument);
+    BOOST_CHECK_THROW(semi_index::value_index_builder("a,b"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(value_index)
+{
+    using semi_index::json_semi_index;
+    std::string buffer =
+        "{\"user\": {\"id\": 7}, \"action\": \"edit\", \"tags\": [\"a\", \"b\", \"a\"]}\n"
+        "{\"user\": {\"id\": 3}, \"action\": \"delete\", \"tags\": []}\n"
+        "{\"user\": {\"id\":  7 }, \"action\": \"delete\", \"tags\": [\"b\"]}\n"
+        "{\"action\": \"edit\"}\n"
+        "{\"user\": {\"id\": {\"x\": 1}}, \"action\": null, \"tags\": [\"c\"]}\n"
+        "{\"user\": {\"id\": 7}, \"action\": \"delete\"}\n";
+    semi_index::json_semi_index_builder builder;
+    builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index index(&builder);
+
+    semi_index::value_index users;
+    build_value_index(index, buffer, "user.id", users);
+    BOOST_CHECK_EQUAL("user.id", users.path());
+    BOOST_CHECK_EQUAL(6U, users.num_documents());
+    BOOST_REQUIRE_EQUAL(2U, users.num_values()); // objects are not indexed
+    BOOST_CHECK_EQUAL("3", users.value(0));
+    BOOST_CHECK_EQUAL("7", users.value(1));
+    BOOST_CHECK_EQUAL(uint64_t(semi_index::value_index::not_found), users.value_id("5"));
+
+    uint64_t seven = users.value_id("7");
+    BOOST_REQUIRE_EQUAL(3U, users.num_postings(seven));
+    BOOST_CHECK_EQUAL(0U, users.posting(seven, 0));
+    BOOST_CHECK_EQUAL(2U, users.posting(seven, 1));
+    BOOST_CHECK_EQUAL(5U, users.posting(seven, 2));
+    BOOST_CHECK(users.contains(seven, 2));
+    BOOST_CHECK(!users.contains(seven, 1));
+    BOOST_CHECK(!users.contains(users.value_id("3"), 0));
+
+    semi_index::value_index actions;
+    build_value_index(index, buffer, "action", actions);
+    BOOST_CHECK_EQUAL(3U, actions.num_values());
+    BOOST_CHECK_EQUAL(1U, actions.num_postings(actions.value_id("null")));
+
+    // documents are listed once even if several matches have the value
+    semi_index::value_index tags;
+    build_value_index(index, buffer, "tags[*]", tags);
+    BOOST_CHECK_EQUAL(3U, tags.num_values());
+    BOOST_CHECK_EQUAL(1U, tags.num_postings(tags.value_id("\"a\"")));
+    BOOST_CHECK_EQUAL(2U, tags.num_postings(tags.value_id("\"b\"")));
+
+    std::vector<semi_index::value_condition> conditions;
+    std::vector<uint64_t> docs;
+    conditions.push_back(condition(users, "7"));
+    conditions.push_back(condition(actions, "\"delete\""));
+    semi_index::intersect_postings(conditions, docs);
+    BOOST_REQUIRE_EQUAL(2U, docs.size());
+    BOOST_CHECK_EQUAL(2U, docs[0]);
+    BOOST_CHECK_EQUAL(5U, docs[1]);
+
+    // IN lists are merged, unknown values ignored
+    conditions.clear();
+    conditions.push_back(condition(users, "3, 7, 12"));
+    conditions.push_back(condition(tags, "\"b\",\"c\""));
+    semi_index::intersect_postings(conditions, docs);
+    BOOST_REQUIRE_EQUAL(2U, docs.size());
+    BOOST_CHECK_EQUAL(0U, docs[0]);
+    BOOST_CHECK_EQUAL(2U, docs[1]);
+
+    conditions.push_back(condition(actions, "\"edit\""));
+    semi_index::intersect_postings(conditions, docs);
+    BOOST_REQUIRE_EQUAL(1U, docs.size());
+    BOOST_CHECK_EQUAL(0U, docs[0]);
+
+    conditions.clear();
+    conditions.push_back(condition(users, "12"));
+    semi_index::intersect_postings(conditions, docs);
+    BOOST_CHECK(docs.empty());
+}
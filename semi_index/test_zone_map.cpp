@@ -0,0 +1,71 @@
+#define BOOST_TEST_MODULE zone_map
+#include "succinct/test_common.hpp"
+
+#include "zone_map.hpp"
+#include "json_semi_index.hpp"
+
+namespace {
+
+    std::vector<bool> select(semi_index::zone_map const& zones, std::string const& where)
+    {
+        return semi_index::select_blocks(zones, json::predicate::parse(where));
+    }
+
+    std::string selected_blocks(semi_index::zone_map const& zones, std::string const& where)
+    {
+        std::vector<bool> selected = select(zones, where);
+        std::string s;
+        for (size_t i = 0; i < selected.size(); ++i) {
+            s += selected[i] ? '1' : '0';
+        }
+        return s;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(zone_map)
+{
+    using semi_index::json_semi_index;
+    // blocks of two documents: ids 1-2, 3-4, 5-6 and 7
+    std::string buffer =
+        "{\"id\": 1, \"user\": \"ann\", \"tags\": [\"a\"]}\n"
+        "{\"id\": 2, \"user\": \"bob\", \"flag\": true}\n"
+        "{\"id\": 3, \"user\": \"carl\", \"tags\": [\"b\", \"c\"]}\n"
+        "{\"id\": 4.5, \"user\": \"d\\u0061n\"}\n"
+        "{\"id\": \"x\", \"user\": null}\n"
+        "{\"id\": -0, \"tags\": []}\n"
+        "{\"id\": 7, \"user\": \"eve\", \"flag\": false}\n";
+    semi_index::json_semi_index_builder builder;
+    builder.append_lines(buffer.c_str(), buffer.c_str() + buffer.size());
+    json_semi_index index(&builder);
+
+    semi_index::zone_map_builder zones_builder("id,user,tags[*],flag", 2);
+    for (size_t i = 0; i < index.num_documents(); ++i) {
+        const char* line = buffer.c_str() + index.get_cursor(i).get_offset();
+        zones_builder.add(index.get_cursor(i).get_accessor(line));
+    }
+    semi_index::zone_map zones(zones_builder);
+    BOOST_CHECK_EQUAL(7U, zones.num_documents());
+    BOOST_REQUIRE_EQUAL(4U, zones.num_blocks());
+    BOOST_CHECK_EQUAL("id,user,tags[*],flag", zones.paths());
+
+    // numeric ranges
+    BOOST_CHECK_EQUAL("1111", selected_blocks(zones, ""));
+    BOOST_CHECK_EQUAL("0101", selected_blocks(zones, "id > 4"));
+    BOOST_CHECK_EQUAL("0101", selected_blocks(zones, "id >= 3"));
+    BOOST_CHECK_EQUAL("0010", selected_blocks(zones, "id < 1"));
+    BOOST_CHECK_EQUAL("1100", selected_blocks(zones, "id <= 3 and id > 1"));
+    BOOST_CHECK_EQUAL("0010", selected_blocks(zones, "id == 0"));
+    BOOST_CHECK_EQUAL("1111", selected_blocks(zones, "id != 0"));
+
+    // Bloom filters and string ranges, on the decoded strings
+    BOOST_CHECK_EQUAL("0100", selected_blocks(zones, "user == \"dan\""));
+    BOOST_CHECK_EQUAL("0000", selected_blocks(zones, "user == \"zed\""));
+    BOOST_CHECK_EQUAL("0010", selected_blocks(zones, "user == null or id == \"x\""));
+    BOOST_CHECK_EQUAL("0110", selected_blocks(zones, "tags[*] == \"c\" or user == null"));
+    BOOST_CHECK_EQUAL("1001", selected_blocks(zones, "flag == true or flag == false"));
+
+    // not and undeclared paths never exclude a block
+    BOOST_CHECK_EQUAL("1111", selected_blocks(zones, "not id > 4"));
+    BOOST_CHECK_EQUAL("1111", selected_blocks(zones, "other == 1"));
+    BOOST_CHECK_EQUAL("0101", selected_blocks(zones, "other == 1 and id > 4"));
+}
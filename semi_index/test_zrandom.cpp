@@ -5,6 +5,7 @@
 #include <boost/filesystem.hpp>
 
 #include "zrandom.hpp"
+#include "ordered_parallel_for.hpp"
 
 BOOST_AUTO_TEST_CASE(zrandom_basic)
 {
@@ -58,3 +59,359 @@ BOOST_AUTO_TEST_CASE(zrandom_basic)
     boost::filesystem::remove(compr_filename);
 }    
 
+
+namespace {
+    struct segment_counter {
+        segment_counter()
+            : segments(0)
+        {}
+
+        void operator()(const char* first, const char* last) {
+            ++segments;
+            text.append(first, last);
+        }
+
+        size_t segments;
+        std::string text;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(zrandom_segments)
+{
+    using zrandom::compress;
+    using zrandom::decompressor;
+
+    std::string raw_filename = "_test_zrandom_segments_data";
+    std::string compr_filename = raw_filename + ".gzra";
+
+    std::string raw;
+    srand(42);
+    for (size_t i = 0; i < 100000; ++i) {
+        raw += char('a' + rand() % 26);
+    }
+    {
+        std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+        raw_file_out.write(raw.data(), raw.size());
+    }
+    compress(raw_filename, compr_filename);
+
+    {
+        decompressor dc(compr_filename);
+        size_t bs = dc.block_size();
+        size_t ranges[][2] = {{0, 0}, {0, 10}, {bs - 5, bs + 5}, {bs - 1, 3 * bs + 1}, {0, raw.size()}, {raw.size() - 7, raw.size()}};
+        for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i) {
+            size_t begin = ranges[i][0], end = ranges[i][1];
+            std::string expected = raw.substr(begin, end - begin);
+
+            std::string out = "x";
+            dc.read_range(begin, end, out);
+            BOOST_CHECK_EQUAL("x" + expected, out);
+
+            segment_counter counter;
+            dc.for_each_segment(begin, end, counter);
+            BOOST_CHECK(counter.text == expected);
+            size_t blocks = (begin == end) ? 0 : (end - 1) / bs - begin / bs + 1;
+            BOOST_CHECK_EQUAL(blocks, counter.segments);
+
+            // found by argument-dependent lookup
+            out.clear();
+            append_text(out, dc.begin() + begin, dc.begin() + end);
+            BOOST_CHECK(out == expected);
+        }
+
+        // iterators keep working when moved across blocks and copied
+        decompressor::iterator it = dc.begin() + (bs - 1);
+        BOOST_CHECK_EQUAL(raw[bs - 1], *it);
+        decompressor::iterator copy = it;
+        ++copy;
+        BOOST_CHECK_EQUAL(raw[bs], *copy);
+        BOOST_CHECK_EQUAL(raw[bs - 1], *it);
+        BOOST_CHECK_EQUAL(raw[2 * bs + 3], it[bs + 4]);
+        BOOST_CHECK_EQUAL(raw[0], *(copy - bs));
+    }
+
+    boost::filesystem::remove(raw_filename);
+    boost::filesystem::remove(compr_filename);
+}
+
+namespace {
+    // each task reads a range that straddles a few blocks and reports
+    // whether it matches the raw text
+    struct range_check_task {
+        range_check_task(zrandom::decompressor const& dc, std::string const& raw)
+            : m_dc(dc)
+            , m_raw(raw)
+        {}
+
+        void operator()(size_t /* thread */, size_t task, std::string& out) {
+            size_t begin = (task * 7919) % m_raw.size();
+            size_t end = std::min(begin + 3 * m_dc.block_size(), m_raw.size());
+            std::string text;
+            m_dc.read_range(begin, end, text);
+            out = (text == m_raw.substr(begin, end - begin)) ? "" : "x";
+        }
+
+        zrandom::decompressor const& m_dc;
+        std::string const& m_raw;
+    };
+
+    struct concat_sink {
+        void operator()(std::string const& out) {
+            result += out;
+        }
+
+        std::string result;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(zrandom_shared_cache)
+{
+    using zrandom::compress;
+    using zrandom::decompressor;
+
+    std::string raw_filename = "_test_zrandom_cache_data";
+    std::string compr_filename = raw_filename + ".gzra";
+
+    std::string raw;
+    srand(42);
+    for (size_t i = 0; i < 1000000; ++i) {
+        raw += char('a' + rand() % 26);
+    }
+    {
+        std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+        raw_file_out.write(raw.data(), raw.size());
+    }
+    compress(raw_filename, compr_filename);
+
+    {
+        // a cache smaller than a block still keeps one block per shard
+        decompressor dc(compr_filename, 1);
+        dc.read_block(0);
+        dc.read_block(0);
+        dc.read_block(16);
+        dc.read_block(0);
+        decompressor::cache_stats stats = dc.get_cache_stats();
+        BOOST_CHECK_EQUAL(1U, stats.hits);
+        BOOST_CHECK_EQUAL(3U, stats.misses);
+        BOOST_CHECK_EQUAL(2U, stats.evictions);
+
+        // blocks 0 and 1 are in different shards
+        dc.read_block(1);
+        dc.read_block(0);
+        stats = dc.get_cache_stats();
+        BOOST_CHECK_EQUAL(2U, stats.hits);
+    }
+
+    {
+        decompressor dc(compr_filename, 8 * 16384);
+        range_check_task task(dc, raw);
+        concat_sink sink;
+        semi_index::ordered_parallel_for(2000, 4, task, sink);
+        BOOST_CHECK_EQUAL("", sink.result);
+
+        decompressor::cache_stats stats = dc.get_cache_stats();
+        BOOST_CHECK(stats.hits > 0);
+        BOOST_CHECK(stats.evictions > 0);
+    }
+
+    boost::filesystem::remove(raw_filename);
+    boost::filesystem::remove(compr_filename);
+}
+
+BOOST_AUTO_TEST_CASE(zrandom_parallel_compress)
+{
+    using zrandom::compress;
+    using zrandom::decompressor;
+
+    std::string raw_filename = "_test_zrandom_parallel_data";
+    std::string compr_filename = raw_filename + ".gzra";
+
+    std::string text;
+    srand(42);
+    for (size_t i = 0; i < 1000000; ++i) {
+        text += char('a' + rand() % 26);
+    }
+
+    {
+        std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+        raw_file_out.write(text.data(), 1000);
+    }
+    BOOST_CHECK_THROW(compress(raw_filename, compr_filename, 2, 10), std::invalid_argument);
+    BOOST_CHECK_THROW(compress(raw_filename, compr_filename, 2, -2), std::invalid_argument);
+    BOOST_CHECK_THROW(compress(raw_filename, compr_filename, 2, 9, 0), std::invalid_argument);
+    BOOST_CHECK_THROW(compress(raw_filename, compr_filename, 0), std::invalid_argument);
+
+    // blocks larger than a deflate block, sizes that are multiples of the
+    // block size, empty files
+    size_t sizes[] = {1000000, 300000, 100000, 1, 0};
+    size_t block_sizes[] = {100000, 4096};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        std::string raw = text.substr(0, sizes[i]);
+        {
+            std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+            raw_file_out.write(raw.data(), raw.size());
+        }
+        for (size_t j = 0; j < sizeof(block_sizes) / sizeof(block_sizes[0]); ++j) {
+            compress(raw_filename, compr_filename, 3, 6, block_sizes[j]);
+            decompressor dc(compr_filename);
+            BOOST_CHECK_EQUAL(block_sizes[j], dc.block_size());
+            BOOST_CHECK_EQUAL(raw.size() / block_sizes[j] + 1, dc.num_blocks());
+            BOOST_CHECK_EQUAL(raw.size(), size_t(dc.end() - dc.begin()));
+
+            std::string out;
+            dc.read_range(0, raw.size(), out);
+            BOOST_CHECK_MESSAGE(out == raw, "Size " << raw.size() << ", block size " << block_sizes[j]);
+            if (raw.size() > 3) {
+                out.clear();
+                dc.read_range(raw.size() - 3, raw.size(), out);
+                BOOST_CHECK(out == raw.substr(raw.size() - 3));
+            }
+        }
+    }
+
+    boost::filesystem::remove(raw_filename);
+    boost::filesystem::remove(compr_filename);
+}
+
+BOOST_AUTO_TEST_CASE(zrandom_aligned_blocks)
+{
+    using zrandom::compress;
+    using zrandom::decompressor;
+
+    std::string raw_filename = "_test_zrandom_aligned_data";
+    std::string compr_filename = raw_filename + ".gzra";
+
+    const size_t block_size = 4096;
+    std::string raw;
+    std::vector<size_t> line_starts;
+    srand(42);
+    for (size_t i = 0; i < 2000; ++i) {
+        line_starts.push_back(raw.size());
+        // a few lines are longer than a block
+        size_t len = (i % 500 == 7) ? 3 * block_size : rand() % 1000;
+        for (size_t j = 0; j < len; ++j) {
+            raw += char('a' + rand() % 26);
+        }
+        raw += '\n';
+    }
+    {
+        std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+        raw_file_out.write(raw.data(), raw.size());
+    }
+    compress(raw_filename, compr_filename, 2, 9, block_size, true);
+
+    {
+        decompressor dc(compr_filename);
+        std::string out;
+        dc.read_range(0, raw.size(), out);
+        BOOST_CHECK(out == raw);
+
+        BOOST_CHECK_EQUAL(0U, dc.block_begin(0));
+        for (size_t b = 1; b < dc.num_blocks(); ++b) {
+            size_t begin = dc.block_begin(b);
+            BOOST_CHECK(begin > dc.block_begin(b - 1));
+            BOOST_CHECK(begin - dc.block_begin(b - 1) <= block_size);
+            BOOST_CHECK_EQUAL(b, dc.block_of(begin));
+            BOOST_CHECK_EQUAL(b - 1, dc.block_of(begin - 1));
+        }
+
+        line_starts.push_back(raw.size());
+        for (size_t i = 0; i + 1 < line_starts.size(); ++i) {
+            size_t begin = line_starts[i], end = line_starts[i + 1];
+            if (end - begin <= block_size) {
+                BOOST_CHECK_EQUAL(dc.block_of(begin), dc.block_of(end - 1));
+            }
+            out.clear();
+            dc.read_range(begin, end, out);
+            BOOST_CHECK(out == raw.substr(begin, end - begin));
+        }
+    }
+
+    boost::filesystem::remove(raw_filename);
+    boost::filesystem::remove(compr_filename);
+}
+
+BOOST_AUTO_TEST_CASE(zrandom_partial_inflation)
+{
+    using zrandom::compress;
+    using zrandom::decompressor;
+
+    std::string raw_filename = "_test_zrandom_partial_data";
+    std::string compr_filename = raw_filename + ".gzra";
+
+    std::string raw;
+    srand(42);
+    for (size_t i = 0; i < 100000; ++i) {
+        raw += char('a' + rand() % 26);
+    }
+    {
+        std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+        raw_file_out.write(raw.data(), raw.size());
+    }
+    compress(raw_filename, compr_filename);
+
+    {
+        decompressor dc(compr_filename);
+        size_t bs = dc.block_size();
+
+        // only the beginning of the block is inflated
+        decompressor::iterator it = dc.begin();
+        BOOST_CHECK_EQUAL(raw[0], *it);
+        uint64_t inflated = dc.get_cache_stats().inflated_bytes;
+        BOOST_CHECK(inflated > 0);
+        BOOST_CHECK(inflated < bs);
+
+        // the inflation resumes, and the block is inflated once
+        BOOST_CHECK_EQUAL(raw[bs / 2], it[bs / 2]);
+        BOOST_CHECK_EQUAL(raw[10], *(dc.begin() + 10));
+        BOOST_CHECK(dc.get_cache_stats().inflated_bytes > inflated);
+        BOOST_CHECK(dc.get_cache_stats().inflated_bytes <= bs);
+        BOOST_CHECK_EQUAL(raw[bs - 1], it[bs - 1]);
+        BOOST_CHECK_EQUAL(bs, dc.get_cache_stats().inflated_bytes);
+        BOOST_CHECK_EQUAL(1U, dc.get_cache_stats().misses);
+
+        // whole blocks are inflated on request
+        decompressor::block_ptr_t block = dc.read_block(1);
+        BOOST_CHECK(std::string(block->second.begin(), block->second.end()) == raw.substr(bs, bs));
+        BOOST_CHECK_EQUAL(2 * bs, dc.get_cache_stats().inflated_bytes);
+    }
+
+    boost::filesystem::remove(raw_filename);
+    boost::filesystem::remove(compr_filename);
+}
+
+BOOST_AUTO_TEST_CASE(zrandom_corrupt_block)
+{
+    using zrandom::compress;
+    using zrandom::decompressor;
+
+    std::string raw_filename = "_test_zrandom_corrupt_data";
+    std::string compr_filename = raw_filename + ".gzra";
+
+    {
+        srand(42);
+        std::ofstream raw_file_out(raw_filename.c_str(), std::ios::binary);
+        for (size_t i = 0; i < 100000; ++i) {
+            raw_file_out.put(char('a' + rand() % 26));
+        }
+    }
+    compress(raw_filename, compr_filename);
+    {
+        // a stored block header with inconsistent lengths at the
+        // beginning of the first block
+        std::fstream compr_file(compr_filename.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+        compr_file.seekp(sizeof(uint64_t));
+        compr_file.write(std::string(16, '\0').data(), 16);
+    }
+
+    {
+        decompressor dc(compr_filename);
+        BOOST_CHECK_THROW(*dc.begin(), std::runtime_error);
+        BOOST_CHECK_THROW(dc.read_block(0), std::runtime_error);
+        // the other blocks are independent
+        BOOST_CHECK_EQUAL(dc.block_size(), dc.read_block(1)->second.size());
+    }
+
+    boost::filesystem::remove(raw_filename);
+    boost::filesystem::remove(compr_filename);
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <stdint.h>
+
+#include "escape_table.hpp"
+
+namespace semi_index {
+
+    enum value_type {
+        invalid_type,
+        null_type,
+        bool_type,
+        number_type,
+        string_type,
+        array_type,
+        object_type
+    };
+
+    typedef std::pair<const char*, const char*> string_view_t;
+
+    // Decoding of the JSON scalars in place, without going through the
+    // generic parser. Iterator must support random access by offset,
+    // like the Iterator of json_semi_index_base
+    namespace detail {
+
+        inline bool is_json_space(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        inline value_type type_of(char c) {
+            switch (c) {
+            case 'n': return null_type;
+            case 't': case 'f': return bool_type;
+            case '"': return string_type;
+            case '[': return array_type;
+            case '{': return object_type;
+            case '-':
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                return number_type;
+            default:
+                return invalid_type;
+            }
+        }
+
+        // Appends the text in [first, last) to out. Iterators on
+        // segmented buffers overload it in their namespace, so it must be
+        // called unqualified
+        template <typename Iterator>
+        void append_text(std::string& out, Iterator first, Iterator last) {
+            out.append(first, last);
+        }
+
+        // The text in [pos, end) as a contiguous range: in place if the
+        // JSON is contiguous, otherwise copied to buffer
+        template <typename Iterator>
+        string_view_t contiguous_text(Iterator json, size_t pos, size_t end, std::string& buffer) {
+            buffer.clear();
+            append_text(buffer, json + pos, json + end);
+            return string_view_t(buffer.data(), buffer.data() + buffer.size());
+        }
+
+        inline string_view_t contiguous_text(const char* json, size_t pos, size_t end, std::string& /* buffer */) {
+            return string_view_t(json + pos, json + end);
+        }
+
+        // Skips the leading whitespace of [pos, end)
+        template <typename Iterator>
+        size_t skip_space(Iterator json, size_t pos, size_t end) {
+            while (pos != end && is_json_space(*(json + pos))) ++pos;
+            return pos;
+        }
+
+        // Skips the trailing whitespace of [begin, end)
+        template <typename Iterator>
+        size_t trim_space(Iterator json, size_t begin, size_t end) {
+            while (end != begin && is_json_space(*(json + (end - 1)))) --end;
+            return end;
+        }
+
+        template <typename Iterator>
+        bool match_literal(Iterator json, size_t pos, size_t end, const char* literal) {
+            size_t len = strlen(literal);
+            if (end - pos != len) return false;
+            for (size_t i = 0; i < len; ++i) {
+                if (*(json + (pos + i)) != literal[i]) return false;
+            }
+            return true;
+        }
+
+        template <typename Iterator>
+        int64_t parse_int64(Iterator json, size_t pos, size_t end) {
+            bool negative = false;
+            if (pos != end && *(json + pos) == '-') {
+                negative = true;
+                ++pos;
+            }
+            if (pos == end) {
+                throw std::invalid_argument("Not an integer");
+            }
+            // accumulate negatively, so that INT64_MIN fits
+            const int64_t min = int64_t(uint64_t(1) << 63);
+            int64_t value = 0;
+            for (; pos != end; ++pos) {
+                char c = *(json + pos);
+                if (c < '0' || c > '9') {
+                    throw std::invalid_argument("Not an integer");
+                }
+                int digit = c - '0';
+                if (value < (min + digit) / 10) {
+                    throw std::out_of_range("Integer out of range");
+                }
+                value = value * 10 - digit;
+            }
+            if (!negative) {
+                if (value == min) {
+                    throw std::out_of_range("Integer out of range");
+                }
+                value = -value;
+            }
+            return value;
+        }
+
+        inline bool is_digit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        // Parses the JSON number at the beginning of [first, last) and
+        // returns its end, or 0 if there is no valid number. Numbers with
+        // up to 19 significant digits and a decimal exponent within
+        // +-22 are converted exactly with Clinger's fast path, as both
+        // the mantissa and the power of ten are exact doubles; integers
+        // that fit 53 bits never touch the floating point unit until
+        // the final conversion. The other numbers fall back to strtod
+        inline const char* parse_number(const char* first, const char* last, double& value) {
+            static const double pow10[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+
+            const char* p = first;
+            bool negative = false;
+            if (p != last && *p == '-') {
+                negative = true;
+                ++p;
+            }
+            if (p == last || !is_digit(*p)) return 0;
+
+            uint64_t mantissa = 0;
+            int digits = 0; // significant digits in mantissa
+            bool truncated = false;
+            int64_t exp10 = 0;
+
+            if (*p == '0') {
+                ++p;
+            } else {
+                for (; p != last && is_digit(*p); ++p) {
+                    if (digits < 19) {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        ++digits;
+                    } else {
+                        truncated = true;
+                        ++exp10;
+                    }
+                }
+            }
+            if (p != last && *p == '.') {
+                ++p;
+                if (p == last || !is_digit(*p)) return 0;
+                for (; p != last && is_digit(*p); ++p) {
+                    if (digits < 19) {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        if (mantissa) ++digits; // leading zeros are not significant
+                        --exp10;
+                    } else {
+                        truncated = true;
+                    }
+                }
+            }
+            if (p != last && (*p == 'e' || *p == 'E')) {
+                ++p;
+                bool exp_negative = false;
+                if (p != last && (*p == '+' || *p == '-')) {
+                    exp_negative = (*p == '-');
+                    ++p;
+                }
+                if (p == last || !is_digit(*p)) return 0;
+                int64_t exp = 0;
+                for (; p != last && is_digit(*p); ++p) {
+                    if (exp < 100000) exp = exp * 10 + (*p - '0');
+                }
+                exp10 += exp_negative ? -exp : exp;
+            }
+
+            if (!truncated && mantissa <= (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+                value = double(mantissa);
+                if (exp10 < 0) {
+                    value /= pow10[-exp10];
+                } else {
+                    value *= pow10[exp10];
+                }
+                if (negative) value = -value;
+                return p;
+            }
+
+            // slow path, strtod needs a null-terminated string
+            size_t len = p - first;
+            char buf[64];
+            if (len < sizeof(buf)) {
+                memcpy(buf, first, len);
+                buf[len] = 0;
+                value = strtod(buf, 0);
+            } else {
+                value = strtod(std::string(first, p).c_str(), 0);
+            }
+            return p;
+        }
+
+        template <typename Iterator>
+        double parse_double(Iterator json, size_t pos, size_t end) {
+            // JSON numbers are usually short, copy the text to a local
+            // buffer to make it contiguous
+            if (pos == end) {
+                throw std::invalid_argument("Not a number");
+            }
+            char buf[64];
+            std::string long_buf;
+            const char* first = buf;
+            if (end - pos <= sizeof(buf)) {
+                for (size_t i = 0; pos + i != end; ++i) {
+                    buf[i] = *(json + (pos + i));
+                }
+            } else {
+                for (size_t i = pos; i != end; ++i) {
+                    long_buf += *(json + i);
+                }
+                first = long_buf.data();
+            }
+            const char* last = first + (end - pos);
+            double value;
+            if (parse_number(first, last, value) != last) {
+                throw std::invalid_argument("Not a number");
+            }
+            return value;
+        }
+
+        inline char* append_utf8(char* out, uint32_t cp) {
+            if (cp < 0x80) {
+                *out++ = char(cp);
+            } else if (cp < 0x800) {
+                *out++ = char(0xC0 | (cp >> 6));
+                *out++ = char(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                *out++ = char(0xE0 | (cp >> 12));
+                *out++ = char(0x80 | ((cp >> 6) & 0x3F));
+                *out++ = char(0x80 | (cp & 0x3F));
+            } else {
+                *out++ = char(0xF0 | (cp >> 18));
+                *out++ = char(0x80 | ((cp >> 12) & 0x3F));
+                *out++ = char(0x80 | ((cp >> 6) & 0x3F));
+                *out++ = char(0x80 | (cp & 0x3F));
+            }
+            return out;
+        }
+
+        template <typename Iterator>
+        uint32_t parse_hex4(Iterator json, size_t pos, size_t end) {
+            if (end - pos < 4) {
+                throw std::invalid_argument("Invalid \\u escape");
+            }
+            uint32_t cp = 0;
+            for (size_t i = 0; i < 4; ++i) {
+                char c = *(json + (pos + i));
+                cp <<= 4;
+                if (c >= '0' && c <= '9') cp |= c - '0';
+                else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+                else throw std::invalid_argument("Invalid \\u escape");
+            }
+            return cp;
+        }
+
+        // Decodes the escapes of the string contents [pos, end) into
+        // out, which must have room for end - pos characters, and
+        // returns the decoded length; \u escapes, including surrogate
+        // pairs, become UTF-8, which is never longer than the escape
+        template <typename Iterator>
+        size_t unescape_to(Iterator json, size_t pos, size_t end, char* out) {
+            char* out_begin = out;
+            while (pos != end) {
+                char c = *(json + pos++);
+                if (c != '\\') {
+                    *out++ = c;
+                    continue;
+                }
+                if (pos == end) {
+                    throw std::invalid_argument("Invalid escape");
+                }
+                c = *(json + pos++);
+                if (c != 'u') {
+                    *out++ = (char)json::parser::escape_table[(unsigned char)c];
+                    continue;
+                }
+                uint32_t cp = parse_hex4(json, pos, end);
+                pos += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && end - pos >= 6 &&
+                    *(json + pos) == '\\' && *(json + (pos + 1)) == 'u') {
+                    uint32_t low = parse_hex4(json, pos + 2, end);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        pos += 6;
+                    }
+                }
+                out = append_utf8(out, cp);
+            }
+            return out - out_begin;
+        }
+
+        template <typename Iterator>
+        void unescape(Iterator json, size_t pos, size_t end, std::string& out) {
+            out.resize(end - pos);
+            if (end == pos) return;
+            out.resize(unescape_to(json, pos, end, &out[0]));
+        }
+
+        // Contiguous input: strings without escapes are returned in place
+        inline string_view_t unescaped_view(const char* json, size_t pos, size_t end, std::string& buffer) {
+            if (!memchr(json + pos, '\\', end - pos)) {
+                return string_view_t(json + pos, json + end);
+            }
+            unescape(json, pos, end, buffer);
+            return string_view_t(buffer.data(), buffer.data() + buffer.size());
+        }
+
+        template <typename Iterator>
+        string_view_t unescaped_view(Iterator json, size_t pos, size_t end, std::string& buffer) {
+            unescape(json, pos, end, buffer);
+            return string_view_t(buffer.data(), buffer.data() + buffer.size());
+        }
+    }
+}
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <map>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+#include "succinct/elias_fano.hpp"
+#include "succinct/mappable_vector.hpp"
+
+#include "path_parser.hpp"
+#include "value_decoder.hpp"
+
+namespace semi_index {
+
+    // Collects the values of a path in each document of a collection,
+    // fed one document at a time. Values are identified by their text
+    // as written, so 1000 and 1e3 are different values; the matches of
+    // multi-valued paths are all collected, missing values and
+    // containers are not
+    class value_index_builder : boost::noncopyable {
+    public:
+        // Throws std::invalid_argument if path_spec is not a single path
+        explicit value_index_builder(std::string const& path_spec)
+            : m_path(path_spec)
+            , m_num_docs(0)
+        {
+            json::path::path_list_t paths = json::path::parse(path_spec);
+            if (paths.size() != 1 || paths[0].empty()) {
+                throw std::invalid_argument("A value index needs exactly one path");
+            }
+            m_trie = json::path::path_trie(paths);
+        }
+
+        // Adds the next document, at root, whose text starts at line
+        template <typename Accessor, typename Iterator>
+        void add(Accessor const& root, Iterator line) {
+            std::vector<Accessor> values;
+            std::vector<std::pair<size_t, Accessor> > matches;
+            root.get_paths(m_trie, values, matches);
+            if (m_trie.multi_valued[0]) {
+                for (size_t i = 0; i < matches.size(); ++i) {
+                    add_value(matches[i].second, line);
+                }
+            } else {
+                add_value(values[0], line);
+            }
+            ++m_num_docs;
+        }
+
+        uint64_t num_documents() const {
+            return m_num_docs;
+        }
+
+        friend class value_index;
+
+    private:
+        template <typename Accessor, typename Iterator>
+        void add_value(Accessor const& value, Iterator line) {
+            value_type type = value.type();
+            if (type == invalid_type || type == array_type || type == object_type) {
+                return;
+            }
+            typename Accessor::range_t r = value.get_range();
+            size_t begin = detail::skip_space(line, r.first, r.second);
+            size_t end = detail::trim_space(line, begin, r.second);
+            using detail::append_text;
+            m_key.clear();
+            append_text(m_key, line + begin, line + end);
+
+            std::map<std::string, uint64_t>::const_iterator it = m_dict.find(m_key);
+            uint64_t id;
+            if (it != m_dict.end()) {
+                id = it->second;
+            } else {
+                id = m_dict.size();
+                m_dict[m_key] = id;
+            }
+            m_postings.push_back(std::make_pair(id, m_num_docs));
+        }
+
+        std::string m_path;
+        json::path::path_trie m_trie;
+        std::map<std::string, uint64_t> m_dict;
+        std::vector<std::pair<uint64_t, uint64_t> > m_postings; // (value id, doc id)
+        uint64_t m_num_docs;
+        std::string m_key;
+    };
+
+    // Inverted index of the values of a path: the sorted dictionary of
+    // the distinct values and, for each value, the sorted list of the
+    // documents that contain it. The posting lists are concatenated in
+    // a single Elias-Fano sequence, where the posting of document d in
+    // the list of value v is v * num_documents + d; the start of each
+    // list is stored in a second Elias-Fano sequence
+    class value_index {
+    public:
+        static const uint64_t not_found = uint64_t(-1);
+
+        value_index()
+            : m_num_docs(0)
+        {}
+
+        value_index(value_index_builder& builder)
+            : m_num_docs(builder.m_num_docs)
+        {
+            std::vector<char> path(builder.m_path.begin(), builder.m_path.end());
+            m_path.steal(path);
+
+            // ids are renumbered in the order of the sorted values
+            uint64_t num_values = builder.m_dict.size();
+            std::vector<uint64_t> remap(num_values);
+            std::vector<char> chars;
+            std::vector<uint64_t> offsets;
+            typedef std::map<std::string, uint64_t>::const_iterator dict_iter;
+            for (dict_iter it = builder.m_dict.begin(); it != builder.m_dict.end(); ++it) {
+                remap[it->second] = offsets.size();
+                offsets.push_back(chars.size());
+                chars.insert(chars.end(), it->first.begin(), it->first.end());
+            }
+            offsets.push_back(chars.size());
+            m_dict_chars.steal(chars);
+            m_dict_offsets.steal(offsets);
+
+            // a document is listed once per value, even if several
+            // matches of the path have it
+            std::vector<std::pair<uint64_t, uint64_t> >& postings = builder.m_postings;
+            for (size_t i = 0; i < postings.size(); ++i) {
+                postings[i].first = remap[postings[i].first];
+            }
+            std::sort(postings.begin(), postings.end());
+            postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+
+            succinct::elias_fano::elias_fano_builder
+                postings_builder(std::max(num_values * m_num_docs, uint64_t(1)), postings.size());
+            succinct::elias_fano::elias_fano_builder
+                lists_builder(postings.size() + 1, num_values);
+            for (size_t i = 0; i < postings.size(); ++i) {
+                if (i == 0 || postings[i].first != postings[i - 1].first) {
+                    lists_builder.push_back(i);
+                }
+                postings_builder.push_back(postings[i].first * m_num_docs + postings[i].second);
+            }
+            succinct::elias_fano(&postings_builder, false).swap(m_postings);
+            succinct::elias_fano(&lists_builder, false).swap(m_lists);
+        }
+
+        template <typename Visitor>
+        void map(Visitor& visit) {
+            visit
+                (m_path, "m_path")
+                (m_num_docs, "m_num_docs")
+                (m_dict_chars, "m_dict_chars")
+                (m_dict_offsets, "m_dict_offsets")
+                (m_postings, "m_postings")
+                (m_lists, "m_lists")
+                ;
+        }
+
+        void swap(value_index& other) {
+            m_path.swap(other.m_path);
+            std::swap(m_num_docs, other.m_num_docs);
+            m_dict_chars.swap(other.m_dict_chars);
+            m_dict_offsets.swap(other.m_dict_offsets);
+            m_postings.swap(other.m_postings);
+            m_lists.swap(other.m_lists);
+        }
+
+        // The path the index was built on, as given to the builder
+        std::string path() const {
+            return std::string(m_path.begin(), m_path.end());
+        }
+
+        uint64_t num_documents() const {
+            return m_num_docs;
+        }
+
+        uint64_t num_values() const {
+            return m_dict_offsets.size() ? m_dict_offsets.size() - 1 : 0;
+        }
+
+        std::string value(uint64_t id) const {
+            return std::string(m_dict_chars.begin() + m_dict_offsets[id],
+                               m_dict_chars.begin() + m_dict_offsets[id + 1]);
+        }
+
+        // Id of the value, written as in the documents, or not_found if
+        // no document has it
+        uint64_t value_id(std::string const& value) const {
+            uint64_t lo = 0, hi = num_values();
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                int cmp = compare(mid, value);
+                if (cmp == 0) {
+                    return mid;
+                } else if (cmp < 0) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return not_found;
+        }
+
+        // Number of documents that have the value
+        uint64_t num_postings(uint64_t id) const {
+            return list_begin(id + 1) - list_begin(id);
+        }
+
+        // i-th document, in increasing order, that has the value
+        uint64_t posting(uint64_t id, uint64_t i) const {
+            assert(i < num_postings(id));
+            return m_postings.select(list_begin(id) + i) - id * m_num_docs;
+        }
+
+        // Whether the document has the value, by binary search on the
+        // posting list
+        bool contains(uint64_t id, uint64_t doc) const {
+            uint64_t target = id * m_num_docs + doc;
+            uint64_t lo = list_begin(id), hi = list_begin(id + 1);
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                uint64_t pos = m_postings.select(mid);
+                if (pos == target) {
+                    return true;
+                } else if (pos < target) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return false;
+        }
+
+    private:
+        uint64_t list_begin(uint64_t id) const {
+            return (id < num_values()) ? m_lists.select(id) : m_postings.num_ones();
+        }
+
+        int compare(uint64_t id, std::string const& value) const {
+            const char* v = m_dict_chars.begin() + m_dict_offsets[id];
+            size_t len = m_dict_offsets[id + 1] - m_dict_offsets[id];
+            int cmp = memcmp(v, value.data(), std::min(len, value.size()));
+            if (cmp) return cmp;
+            return (len < value.size()) ? -1 : (len > value.size() ? 1 : 0);
+        }
+
+        succinct::mapper::mappable_vector<char> m_path;
+        uint64_t m_num_docs;
+        succinct::mapper::mappable_vector<char> m_dict_chars;
+        succinct::mapper::mappable_vector<uint64_t> m_dict_offsets;
+        succinct::elias_fano m_postings;
+        succinct::elias_fano m_lists; // start of each posting list
+    };
+
+    // Splits a comma-separated list of JSON scalars, such as
+    // "delete","restore" or 1,2,3, leaving the commas inside strings
+    inline std::vector<std::string> parse_value_list(std::string const& s)
+    {
+        std::vector<std::string> values;
+        size_t begin = 0;
+        bool in_string = false;
+        for (size_t i = 0; i <= s.size(); ++i) {
+            if (i == s.size() || (!in_string && s[i] == ',')) {
+                size_t first = detail::skip_space(s.data(), begin, i);
+                size_t last = detail::trim_space(s.data(), first, i);
+                if (first == last) {
+                    throw std::invalid_argument("Empty value in list \"" + s + "\"");
+                }
+                values.push_back(s.substr(first, last - first));
+                begin = i + 1;
+            } else if (s[i] == '"') {
+                in_string = !in_string;
+            } else if (in_string && s[i] == '\\') {
+                ++i;
+            }
+        }
+        return values;
+    }
+
+    // Equality or IN condition on the path of a value index
+    struct value_condition {
+        value_index const* index;
+        std::vector<std::string> values;
+    };
+
+    // Sorted ids of the documents that satisfy all the conditions, that
+    // is that have for each condition one of its values. The posting
+    // lists of the condition with fewest postings are merged, and the
+    // candidates are probed in the lists of the other conditions, so
+    // that the longer lists are never decoded
+    inline void intersect_postings(std::vector<value_condition> const& conditions, std::vector<uint64_t>& docs)
+    {
+        docs.clear();
+        if (conditions.empty()) return;
+
+        std::vector<std::vector<uint64_t> > ids(conditions.size());
+        size_t smallest = 0;
+        uint64_t smallest_postings = uint64_t(-1);
+        for (size_t c = 0; c < conditions.size(); ++c) {
+            value_index const& index = *conditions[c].index;
+            uint64_t postings = 0;
+            for (size_t v = 0; v < conditions[c].values.size(); ++v) {
+                uint64_t id = index.value_id(conditions[c].values[v]);
+                if (id != value_index::not_found) {
+                    ids[c].push_back(id);
+                    postings += index.num_postings(id);
+                }
+            }
+            if (postings < smallest_postings) {
+                smallest = c;
+                smallest_postings = postings;
+            }
+        }
+
+        value_index const& index = *conditions[smallest].index;
+        for (size_t v = 0; v < ids[smallest].size(); ++v) {
+            uint64_t id = ids[smallest][v];
+            for (uint64_t i = 0; i < index.num_postings(id); ++i) {
+                docs.push_back(index.posting(id, i));
+            }
+        }
+        std::sort(docs.begin(), docs.end());
+        docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+
+        for (size_t c = 0; c < conditions.size(); ++c) {
+            if (c == smallest) continue;
+            value_index const& other = *conditions[c].index;
+            size_t kept = 0;
+            for (size_t i = 0; i < docs.size(); ++i) {
+                for (size_t v = 0; v < ids[c].size(); ++v) {
+                    if (other.contains(ids[c][v], docs[i])) {
+                        docs[kept++] = docs[i];
+                        break;
+                    }
+                }
+            }
+            docs.resize(kept);
+        }
+    }
+}
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+#include "succinct/bit_vector.hpp"
+#include "succinct/mappable_vector.hpp"
+
+#include "path_parser.hpp"
+#include "predicate.hpp"
+#include "value_decoder.hpp"
+
+namespace semi_index {
+
+    namespace detail {
+
+        // FNV-1a, stable across platforms since the hashes are stored
+        inline uint64_t fnv_hash(const char* first, const char* last, uint64_t h = 14695981039346656037ULL) {
+            for (; first != last; ++first) {
+                h ^= (unsigned char)*first;
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+
+        // Hash of the value of the path_id-th declared path, as the
+        // predicates compare it: numbers by value, strings decoded
+        inline uint64_t zone_token(size_t path_id, char kind, const char* first, const char* last) {
+            uint64_t id = path_id;
+            char prefix[9];
+            memcpy(prefix, &id, 8);
+            prefix[8] = kind;
+            return fnv_hash(first, last, fnv_hash(prefix, prefix + 9));
+        }
+
+        inline uint64_t zone_token(size_t path_id, double number) {
+            if (number == 0) number = 0; // -0 == 0
+            return zone_token(path_id, 'n', (const char*)&number, (const char*)(&number + 1));
+        }
+    }
+
+    // Collects a summary of each block of block_size consecutive
+    // documents, fed one document at a time: for each declared path the
+    // range of its numeric values and of its string values, and a Bloom
+    // filter of all the values of the declared paths
+    class zone_map_builder : boost::noncopyable {
+    public:
+        static const size_t bloom_hashes = 7;
+        static const size_t bloom_bits_per_value = 10;
+
+        // paths_spec is a list of paths, as in json::path::parse.
+        // Throws std::invalid_argument on syntax errors
+        zone_map_builder(std::string const& paths_spec, size_t block_size)
+            : m_spec(paths_spec)
+            , m_block_size(block_size)
+            , m_num_docs(0)
+        {
+            if (!block_size) {
+                throw std::invalid_argument("The block size must be positive");
+            }
+            json::path::path_list_t paths = json::path::parse(paths_spec);
+            m_trie = json::path::path_trie(paths);
+            m_bloom_offsets.push_back(0);
+            start_block();
+        }
+
+        // Adds the next document, at root
+        template <typename Accessor>
+        void add(Accessor const& root) {
+            std::vector<Accessor> values;
+            std::vector<std::pair<size_t, Accessor> > matches;
+            root.get_paths(m_trie, values, matches);
+            size_t m = 0; // matches are grouped by path
+            for (size_t p = 0; p < values.size(); ++p) {
+                if (!m_trie.multi_valued[p]) {
+                    add_value(p, values[p]);
+                    continue;
+                }
+                for (; m < matches.size() && matches[m].first == p; ++m) {
+                    add_value(p, matches[m].second);
+                }
+            }
+            if (++m_num_docs % m_block_size == 0) {
+                flush_block();
+            }
+        }
+
+        uint64_t num_documents() const {
+            return m_num_docs;
+        }
+
+        friend class zone_map;
+
+    private:
+        struct path_zone {
+            double min;
+            double max;
+            bool has_strings;
+            std::string min_str;
+            std::string max_str;
+        };
+
+        void start_block() {
+            path_zone empty;
+            empty.min = std::numeric_limits<double>::infinity();
+            empty.max = -std::numeric_limits<double>::infinity();
+            empty.has_strings = false;
+            m_zones.assign(m_trie.num_paths, empty);
+            m_tokens.clear();
+        }
+
+        template <typename Accessor>
+        void add_value(size_t p, Accessor const& value) {
+            path_zone& zone = m_zones[p];
+            switch (value.type()) {
+            case null_type:
+                m_tokens.push_back(detail::zone_token(p, 'z', 0, 0));
+                break;
+            case bool_type:
+                m_tokens.push_back(detail::zone_token(p, value.as_bool() ? 't' : 'f', 0, 0));
+                break;
+            case number_type: {
+                double x = value.as_double();
+                zone.min = std::min(zone.min, x);
+                zone.max = std::max(zone.max, x);
+                m_tokens.push_back(detail::zone_token(p, x));
+                break;
+            }
+            case string_type: {
+                string_view_t str = value.as_unescaped_string(m_buffer);
+                m_tokens.push_back(detail::zone_token(p, 's', str.first, str.second));
+                m_str.assign(str.first, str.second);
+                if (!zone.has_strings || m_str < zone.min_str) zone.min_str = m_str;
+                if (!zone.has_strings || m_str > zone.max_str) zone.max_str = m_str;
+                zone.has_strings = true;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        void flush_block() {
+            for (size_t p = 0; p < m_zones.size(); ++p) {
+                path_zone const& zone = m_zones[p];
+                m_min.push_back(zone.min);
+                m_max.push_back(zone.max);
+                m_has_strings.push_back(zone.has_strings);
+                m_str_offsets.push_back(m_str_chars.size());
+                m_str_chars.insert(m_str_chars.end(), zone.min_str.begin(), zone.min_str.end());
+                m_str_offsets.push_back(m_str_chars.size());
+                m_str_chars.insert(m_str_chars.end(), zone.max_str.begin(), zone.max_str.end());
+            }
+
+            std::sort(m_tokens.begin(), m_tokens.end());
+            m_tokens.erase(std::unique(m_tokens.begin(), m_tokens.end()), m_tokens.end());
+            uint64_t bits = std::max(uint64_t(64), (m_tokens.size() * bloom_bits_per_value + 63) / 64 * 64);
+            uint64_t base = m_bloom.size();
+            m_bloom.zero_extend(bits);
+            for (size_t i = 0; i < m_tokens.size(); ++i) {
+                uint64_t h = m_tokens[i];
+                uint64_t step = (h >> 32) | 1;
+                for (size_t k = 0; k < bloom_hashes; ++k) {
+                    m_bloom.set(base + (h + k * step) % bits, 1);
+                }
+            }
+            m_bloom_offsets.push_back(m_bloom.size());
+            start_block();
+        }
+
+        // flushes the last, partial block
+        void finish() {
+            if (m_num_docs % m_block_size) {
+                flush_block();
+            }
+        }
+
+        std::string m_spec;
+        size_t m_block_size;
+        json::path::path_trie m_trie;
+        uint64_t m_num_docs;
+
+        // current block
+        std::vector<path_zone> m_zones;
+        std::vector<uint64_t> m_tokens;
+
+        // blocks so far, one entry per block and declared path
+        std::vector<double> m_min;
+        std::vector<double> m_max;
+        succinct::bit_vector_builder m_has_strings;
+        std::vector<char> m_str_chars;
+        std::vector<uint64_t> m_str_offsets; // of the minimum and of the maximum
+        succinct::bit_vector_builder m_bloom;
+        std::vector<uint64_t> m_bloom_offsets; // one per block, plus the end
+
+        // scratch space
+        std::string m_buffer;
+        std::string m_str;
+    };
+
+    // Summaries of the blocks of consecutive documents of a collection,
+    // built by zone_map_builder. A block can be skipped by a query when
+    // its summary shows that none of its documents satisfies the where
+    // expression; Bloom filters have false positives, so the converse
+    // does not hold
+    class zone_map {
+    public:
+        zone_map()
+            : m_block_size(0)
+            , m_num_docs(0)
+            , m_num_paths(0)
+        {}
+
+        zone_map(zone_map_builder& builder)
+            : m_block_size(builder.m_block_size)
+            , m_num_docs(builder.m_num_docs)
+            , m_num_paths(builder.m_trie.num_paths)
+        {
+            builder.finish();
+            std::vector<char> spec(builder.m_spec.begin(), builder.m_spec.end());
+            m_spec.steal(spec);
+            m_min.steal(builder.m_min);
+            m_max.steal(builder.m_max);
+            succinct::bit_vector(&builder.m_has_strings).swap(m_has_strings);
+            m_str_chars.steal(builder.m_str_chars);
+            m_str_offsets.steal(builder.m_str_offsets);
+            succinct::bit_vector(&builder.m_bloom).swap(m_bloom);
+            m_bloom_offsets.steal(builder.m_bloom_offsets);
+        }
+
+        template <typename Visitor>
+        void map(Visitor& visit) {
+            visit
+                (m_spec, "m_spec")
+                (m_block_size, "m_block_size")
+                (m_num_docs, "m_num_docs")
+                (m_num_paths, "m_num_paths")
+                (m_min, "m_min")
+                (m_max, "m_max")
+                (m_has_strings, "m_has_strings")
+                (m_str_chars, "m_str_chars")
+                (m_str_offsets, "m_str_offsets")
+                (m_bloom, "m_bloom")
+                (m_bloom_offsets, "m_bloom_offsets")
+                ;
+        }
+
+        void swap(zone_map& other) {
+            m_spec.swap(other.m_spec);
+            std::swap(m_block_size, other.m_block_size);
+            std::swap(m_num_docs, other.m_num_docs);
+            std::swap(m_num_paths, other.m_num_paths);
+            m_min.swap(other.m_min);
+            m_max.swap(other.m_max);
+            m_has_strings.swap(other.m_has_strings);
+            m_str_chars.swap(other.m_str_chars);
+            m_str_offsets.swap(other.m_str_offsets);
+            m_bloom.swap(other.m_bloom);
+            m_bloom_offsets.swap(other.m_bloom_offsets);
+        }
+
+        // The declared paths, as given to the builder
+        std::string paths() const {
+            return std::string(m_spec.begin(), m_spec.end());
+        }
+
+        uint64_t block_size() const {
+            return m_block_size;
+        }
+
+        uint64_t num_documents() const {
+            return m_num_docs;
+        }
+
+        uint64_t num_blocks() const {
+            return m_bloom_offsets.size() ? m_bloom_offsets.size() - 1 : 0;
+        }
+
+        // Whether some document of the block may satisfy the
+        // comparison on the path_id-th declared path
+        bool may_match(size_t block, size_t path_id, json::predicate::op_t op,
+                       json::predicate::literal_t const& lit) const {
+            using namespace json::predicate;
+            size_t z = block * m_num_paths + path_id;
+            switch (op) {
+            case op_ne:
+                // missing values and values of other types differ
+                return true;
+            case op_lt: return m_min[z] < lit.number;
+            case op_le: return m_min[z] <= lit.number;
+            case op_gt: return m_max[z] > lit.number;
+            case op_ge: return m_max[z] >= lit.number;
+            case op_eq:
+                break;
+            }
+
+            switch (lit.kind) {
+            case literal_t::null_kind:
+                return may_contain(block, detail::zone_token(path_id, 'z', 0, 0));
+            case literal_t::bool_kind:
+                return may_contain(block, detail::zone_token(path_id, lit.boolean ? 't' : 'f', 0, 0));
+            case literal_t::number_kind:
+                return m_min[z] <= lit.number && lit.number <= m_max[z] &&
+                    may_contain(block, detail::zone_token(path_id, lit.number));
+            case literal_t::string_kind:
+                return m_has_strings[z] &&
+                    compare_str(z, 0, lit.str) <= 0 && compare_str(z, 1, lit.str) >= 0 &&
+                    may_contain(block, detail::zone_token(path_id, 's', lit.str.data(),
+                                                          lit.str.data() + lit.str.size()));
+            }
+            return true;
+        }
+
+    private:
+        bool may_contain(size_t block, uint64_t h) const {
+            uint64_t base = m_bloom_offsets[block];
+            uint64_t bits = m_bloom_offsets[block + 1] - base;
+            uint64_t step = (h >> 32) | 1;
+            for (size_t k = 0; k < zone_map_builder::bloom_hashes; ++k) {
+                if (!m_bloom[base + (h + k * step) % bits]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Compares the minimum (which = 0) or the maximum (which = 1)
+        // string of the zone with s
+        int compare_str(size_t z, size_t which, std::string const& s) const {
+            const char* str = m_str_chars.begin() + m_str_offsets[2 * z + which];
+            size_t len = ((2 * z + which + 1 < m_str_offsets.size())
+                          ? m_str_offsets[2 * z + which + 1] : m_str_chars.size())
+                - m_str_offsets[2 * z + which];
+            int cmp = memcmp(str, s.data(), std::min(len, s.size()));
+            if (cmp) return cmp;
+            return (len < s.size()) ? -1 : (len > s.size() ? 1 : 0);
+        }
+
+        succinct::mapper::mappable_vector<char> m_spec;
+        uint64_t m_block_size;
+        uint64_t m_num_docs;
+        uint64_t m_num_paths;
+        succinct::mapper::mappable_vector<double> m_min;
+        succinct::mapper::mappable_vector<double> m_max;
+        succinct::bit_vector m_has_strings;
+        succinct::mapper::mappable_vector<char> m_str_chars;
+        succinct::mapper::mappable_vector<uint64_t> m_str_offsets;
+        succinct::bit_vector m_bloom;
+        succinct::mapper::mappable_vector<uint64_t> m_bloom_offsets;
+    };
+
+    namespace detail {
+
+        inline bool block_may_match(zone_map const& zones, size_t block, json::predicate::expression const& expr,
+                                    std::vector<size_t> const& comparison_paths, size_t node_idx) {
+            typedef json::predicate::expression::node node_t;
+            node_t const& node = expr.nodes[node_idx];
+            switch (node.kind) {
+            case node_t::and_kind:
+                return block_may_match(zones, block, expr, comparison_paths, node.left) &&
+                    block_may_match(zones, block, expr, comparison_paths, node.right);
+            case node_t::or_kind:
+                return block_may_match(zones, block, expr, comparison_paths, node.left) ||
+                    block_may_match(zones, block, expr, comparison_paths, node.right);
+            case node_t::not_kind:
+                // the summaries only tell which blocks cannot match
+                return true;
+            case node_t::comparison_kind:
+                break;
+            }
+            size_t p = comparison_paths[node.left];
+            if (p == size_t(-1)) {
+                return true;
+            }
+            json::predicate::comparison_t const& cmp = expr.comparisons[node.left];
+            return zones.may_match(block, p, cmp.op, cmp.value);
+        }
+    }
+
+    // For each block of the zone map, whether some of its documents may
+    // satisfy expr. Comparisons on paths that were not declared to the
+    // builder never exclude a block
+    inline std::vector<bool> select_blocks(zone_map const& zones, json::predicate::expression const& expr)
+    {
+        std::vector<bool> selected(zones.num_blocks(), true);
+        if (expr.empty()) {
+            return selected;
+        }
+
+        json::path::path_list_t declared = json::path::parse(zones.paths());
+        std::vector<size_t> comparison_paths(expr.comparisons.size(), size_t(-1));
+        for (size_t c = 0; c < expr.comparisons.size(); ++c) {
+            for (size_t p = 0; p < declared.size(); ++p) {
+                if (declared[p] == expr.comparisons[c].path) {
+                    comparison_paths[c] = p;
+                    break;
+                }
+            }
+        }
+
+        for (size_t b = 0; b < selected.size(); ++b) {
+            selected[b] = detail::block_may_match(zones, b, expr, comparison_paths, expr.root);
+        }
+        return selected;
+    }
+}
@@ -1,130 +1,419 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <list>
 #include <cassert>
 #include <zlib.h>
+#include <stdexcept>
 #include <boost/unordered_map.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "succinct/mapper.hpp"
 #include "zrandom.hpp"
+#include "ordered_parallel_for.hpp"
 
 namespace zrandom {
 
     static const int window_size = -15;
-    static const size_t block_size = 16384;
-    
-    void compress(std::string const& in_filename, std::string const& out_filename)
+
+    namespace {
+        // Text positions of the beginning of the blocks; a file whose size
+        // is a multiple of the fixed block size ends with an empty block
+        std::vector<uint64_t> block_starts(std::string const& in_filename, uint64_t original_size,
+                                           size_t block_size, bool align_lines)
+        {
+            std::vector<uint64_t> starts;
+            if (!align_lines) {
+                for (uint64_t b = 0; b <= original_size / block_size; ++b) {
+                    starts.push_back(b * block_size);
+                }
+                return starts;
+            }
+
+            std::ifstream fin(in_filename.c_str(), std::ios::binary);
+            std::vector<char> buf(block_size);
+            uint64_t pos = 0;
+            while (true) {
+                starts.push_back(pos);
+                if (original_size - pos <= block_size) break;
+                fin.seekg(pos);
+                fin.read(&buf[0], block_size);
+                assert(size_t(fin.gcount()) == block_size);
+                size_t len = block_size;
+                while (len && buf[len - 1] != '\n') --len;
+                // lines longer than a block are split
+                pos += len ? len : block_size;
+            }
+            return starts;
+        }
+
+        // Deflates ranges of blocks of the input into independent raw
+        // streams, so that their concatenation is a single deflate stream
+        // with a flush point at the beginning of each block. The last
+        // block of the file terminates the stream
+        class compress_task : boost::noncopyable {
+        public:
+            compress_task(std::string const& in_filename, size_t threads, int level,
+                          size_t block_size, size_t blocks_per_task, uint64_t original_size,
+                          std::vector<uint64_t> const& starts, std::vector<uint64_t>& checkpoints)
+                : m_blocks_per_task(blocks_per_task)
+                , m_original_size(original_size)
+                , m_starts(starts)
+                , m_checkpoints(checkpoints)
+            {
+                for (size_t t = 0; t < threads; ++t) {
+                    m_states.push_back(new thread_state(in_filename, level, block_size));
+                }
+            }
+
+            // Writes the compressed blocks of the task to out and the
+            // offset of each block within out to the checkpoints
+            void operator()(size_t thread, size_t task, std::string& out) {
+                thread_state& state = m_states[thread];
+                size_t first = task * m_blocks_per_task;
+                size_t last = std::min(first + m_blocks_per_task, m_checkpoints.size());
+
+                // the previous task may have stopped at the end of file
+                state.in.clear();
+                state.in.seekg(m_starts[first]);
+                for (size_t b = first; b < last; ++b) {
+                    m_checkpoints[b] = out.size();
+                    size_t size = ((b + 1 < m_starts.size()) ? m_starts[b + 1] : m_original_size) - m_starts[b];
+                    state.in.read(&state.in_buf[0], size);
+                    assert(size_t(state.in.gcount()) == size);
+
+                    if (deflateReset(&state.strm) != Z_OK) {
+                        throw std::runtime_error("Cannot reset deflate");
+                    }
+                    state.strm.avail_in = size;
+                    state.strm.next_in = (unsigned char*)&state.in_buf[0];
+                    int flush = (b + 1 == m_checkpoints.size()) ? Z_FINISH : Z_FULL_FLUSH;
+                    do {
+                        state.strm.avail_out = state.out_buf.size();
+                        state.strm.next_out = (unsigned char*)&state.out_buf[0];
+                        if (deflate(&state.strm, flush) == Z_STREAM_ERROR) {
+                            throw std::runtime_error("Deflate failed");
+                        }
+                        out.append(&state.out_buf[0], state.out_buf.size() - state.strm.avail_out);
+                    } while (state.strm.avail_out == 0);
+                }
+            }
+
+        private:
+            struct thread_state {
+                thread_state(std::string const& in_filename, int level, size_t block_size)
+                    : in(in_filename.c_str(), std::ios::binary)
+                    , in_buf(block_size)
+                    , out_buf(block_size)
+                {
+                    strm.zalloc = Z_NULL;
+                    strm.zfree = Z_NULL;
+                    strm.opaque = Z_NULL;
+                    int ret = deflateInit2(&strm, level, Z_DEFLATED,
+                                           window_size, 9, Z_DEFAULT_STRATEGY);
+                    if (ret != Z_OK) {
+                        throw std::runtime_error("Cannot initialize deflate");
+                    }
+                }
+
+                ~thread_state() {
+                    deflateEnd(&strm);
+                }
+
+                std::ifstream in;
+                z_stream strm;
+                std::vector<char> in_buf;
+                std::vector<char> out_buf;
+            };
+
+            size_t m_blocks_per_task;
+            uint64_t m_original_size;
+            std::vector<uint64_t> const& m_starts;
+            std::vector<uint64_t>& m_checkpoints;
+            boost::ptr_vector<thread_state> m_states;
+        };
+
+        // Appends the compressed tasks to the file and turns the
+        // checkpoints, relative to the task outputs, into file offsets
+        struct compress_sink {
+            compress_sink(std::ofstream& fout, size_t blocks_per_task,
+                          std::vector<uint64_t>& checkpoints)
+                : m_fout(fout)
+                , m_blocks_per_task(blocks_per_task)
+                , m_checkpoints(checkpoints)
+                , m_task(0)
+                , compressed_size(0)
+            {}
+
+            void operator()(std::string const& out) {
+                size_t first = m_task * m_blocks_per_task;
+                size_t last = std::min(first + m_blocks_per_task, m_checkpoints.size());
+                for (size_t b = first; b < last; ++b) {
+                    m_checkpoints[b] += compressed_size;
+                }
+                m_fout.write(out.data(), out.size());
+                assert(m_fout);
+                compressed_size += out.size();
+                ++m_task;
+            }
+
+            std::ofstream& m_fout;
+            size_t m_blocks_per_task;
+            std::vector<uint64_t>& m_checkpoints;
+            size_t m_task;
+            uint64_t compressed_size;
+        };
+    }
+
+    void compress(std::string const& in_filename, std::string const& out_filename,
+                  size_t threads, int level, size_t block_size, bool align_lines)
     {
+        if (!threads || !block_size) {
+            throw std::invalid_argument("Number of threads and block size must be positive");
+        }
+        // avail_in and avail_out of zlib are 32 bits
+        if (block_size > (size_t(1) << 30)) {
+            throw std::invalid_argument("Block size must be at most 1 GB");
+        }
+        if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+            throw std::invalid_argument("Compression level must be between -1 and 9");
+        }
+
         std::ifstream fin(in_filename.c_str(), std::ios::binary);
+        if (!fin) {
+            throw std::runtime_error("Cannot open " + in_filename);
+        }
+        fin.seekg(0, std::ios::end);
+        uint64_t original_size = fin.tellg();
+        fin.close();
+
         std::ofstream fout(out_filename.c_str(), std::ios::binary);
-        
-        std::vector<uint64_t> checkpoints;
-	uint64_t original_size = 0;
         uint64_t compressed_size = 0;
         fout.write(reinterpret_cast<const char*>(&compressed_size), 
                    sizeof(compressed_size)); // placeholder for later
         assert(fout);
 
-        z_stream strm;
-        int ret;
-        strm.zalloc = Z_NULL;
-        strm.zfree = Z_NULL;
-        strm.opaque = Z_NULL;
-        ret = deflateInit2(&strm, 9, Z_DEFLATED,
-                           window_size, 9, Z_DEFAULT_STRATEGY);
-        assert(ret == Z_OK);
-
-        unsigned char block[block_size];
-        int flush = Z_FULL_FLUSH;
-        do {
-            fin.read((char*)block, block_size);
-            strm.avail_in = fin.gcount();
-            strm.next_in = block;
-	    original_size += strm.avail_in;
-            
-            if (!fin) {
-                flush = Z_FINISH;
-            }
-
-            checkpoints.push_back(compressed_size);
-            do {
-                unsigned char out[block_size];
-                strm.avail_out = block_size;
-                strm.next_out = out;
-                ret = deflate(&strm, flush);
-                assert(ret != Z_STREAM_ERROR);
-                size_t have = block_size - strm.avail_out;
-                fout.write((const char*)out, have);
-                compressed_size += have;
-                assert(fout);
-            } while (strm.avail_out == 0);
-        } while (flush != Z_FINISH);
-
-        deflateEnd(&strm);
+        std::vector<uint64_t> starts = block_starts(in_filename, original_size, block_size, align_lines);
+        std::vector<uint64_t> checkpoints(starts.size());
+        // tasks of about a megabyte of input
+        size_t blocks_per_task = std::max(size_t(1), size_t(1 << 20) / block_size);
+        size_t num_tasks = (checkpoints.size() + blocks_per_task - 1) / blocks_per_task;
+        compress_task task(in_filename, threads, level, block_size, blocks_per_task,
+                           original_size, starts, checkpoints);
+        compress_sink sink(fout, blocks_per_task, checkpoints);
+        semi_index::ordered_parallel_for(num_tasks, threads, task, sink);
+        compressed_size = sink.compressed_size;
 
         succinct::mapper::mappable_vector<uint64_t> out_checkpoints;
         out_checkpoints.steal(checkpoints);
+        uint64_t out_block_size = block_size;
         succinct::mapper::freeze(original_size, fout);
-        succinct::mapper::freeze(block_size, fout);
+        succinct::mapper::freeze(out_block_size, fout);
         succinct::mapper::freeze(out_checkpoints, fout);
+        // the table is optional, so that files with fixed blocks keep
+        // the original format
+        if (align_lines) {
+            succinct::mapper::mappable_vector<uint64_t> out_starts;
+            out_starts.steal(starts);
+            succinct::mapper::freeze(out_starts, fout);
+        }
         
         fout.seekp(0);
         fout.write(reinterpret_cast<const char*>(&compressed_size), 
                    sizeof(compressed_size));
     }
 
+    // A block inflated on demand, up to the furthest position requested
+    // so far; the inflate state is kept to resume from there, and freed
+    // when the block is complete. The text buffer has the length of the
+    // whole block and is never reallocated, and the inflated prefix never
+    // changes, so readers use it without locking once they have seen its
+    // length
+    class decompressor::lazy_block : boost::noncopyable {
+    public:
+	lazy_block(size_t begin, size_t length, const char* compressed, uint64_t compressed_avail)
+	    : m_text(begin, std::vector<char>(length))
+	    , m_inflated(0)
+	    , m_finished(length == 0)
+	    , m_corrupt(false)
+	{
+	    if (m_finished) return;
+	    m_strm.zalloc = Z_NULL;
+	    m_strm.zfree = Z_NULL;
+	    m_strm.opaque = Z_NULL;
+	    if (inflateInit2(&m_strm, window_size) != Z_OK) {
+		throw std::runtime_error("Cannot initialize inflate");
+	    }
+	    // avail_in is 32 bits, a block never needs more
+	    m_strm.avail_in = std::min(compressed_avail, uint64_t(uInt(-1)));
+	    m_strm.next_in = (unsigned char*)compressed;
+	}
+
+	~lazy_block() {
+	    if (!m_finished) {
+		inflateEnd(&m_strm);
+	    }
+	}
+
+	block_t const& text() const {
+	    return m_text;
+	}
+
+	size_t length() const {
+	    return m_text.second.size();
+	}
+
+	// Inflates the block up to the relative position end, and returns
+	// the length of the inflated part; new_bytes is set to the number
+	// of bytes inflated by this call. Throws if the compressed data
+	// ends or is invalid before the end of the block
+	size_t inflate_to(size_t end, size_t& new_bytes) {
+	    boost::mutex::scoped_lock lock(m_mutex);
+	    new_bytes = 0;
+	    if (m_corrupt) {
+		throw std::runtime_error("Corrupt compressed block");
+	    }
+	    end = std::min(end, length());
+	    if (m_finished || end <= m_inflated) {
+		return m_inflated;
+	    }
+
+	    m_strm.avail_out = end - m_inflated;
+	    m_strm.next_out = (unsigned char*)&m_text.second[m_inflated];
+	    // a block can span several deflate blocks
+	    while (m_strm.avail_out) {
+		if (inflate(&m_strm, Z_NO_FLUSH) != Z_OK) break;
+	    }
+	    if (m_strm.avail_out) {
+		// the rest of the buffer would be served as text
+		inflateEnd(&m_strm);
+		m_finished = true;
+		m_corrupt = true;
+		throw std::runtime_error("Corrupt compressed block");
+	    }
+	    new_bytes = end - m_inflated;
+	    m_inflated = end;
+	    if (m_inflated == length()) {
+		inflateEnd(&m_strm);
+		m_finished = true;
+	    }
+	    return m_inflated;
+	}
+
+    private:
+	block_t m_text;
+	boost::mutex m_mutex;
+	z_stream m_strm;
+	size_t m_inflated;
+	bool m_finished;
+	bool m_corrupt;
+    };
+
+    // Blocks are spread by id over independently locked shards, so that
+    // threads reading different blocks rarely contend. Each shard is an
+    // LRU list indexed by a hash map: lookups, promotions and evictions
+    // are constant time
     class decompressor::cache {
     public:
-	cache() 
-	    : m_timestamp(0)
+	cache(size_t capacity_bytes)
+	    : m_shard_capacity(capacity_bytes / num_shards)
 	{}
 
-	block_ptr_t get(size_t key) {
-	    cache_t::iterator found = m_cache.find(key);
-	    if (found != m_cache.end()) {
-		found->second.first = m_timestamp;
-		block_ptr_t block = found->second.second;
-		tick();
-		return block;
+	lazy_block_ptr_t get(size_t key) {
+	    shard& s = m_shards[key % num_shards];
+	    boost::mutex::scoped_lock lock(s.mutex);
+	    index_t::iterator found = s.index.find(key);
+	    if (found == s.index.end()) {
+		++s.stats.misses;
+		return lazy_block_ptr_t();
 	    }
-	    return block_ptr_t();
+	    ++s.stats.hits;
+	    s.lru.splice(s.lru.begin(), s.lru, found->second);
+	    return found->second->second;
 	}
 
-	void put(size_t key, block_ptr_t block) {
-	    if (m_cache.size() == max_entries) {
-		uint64_t min_timestamp = 0;
-		cache_t::iterator min_iter = m_cache.end();
-		for (cache_t::iterator iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
-		    if (min_iter == m_cache.end() || iter->first <= min_timestamp) {
-			min_timestamp = iter->first;
-			min_iter = iter;
-		    }
-		}
-		m_cache.erase(min_iter);
+	// Returns the cached block, which is not block if another thread
+	// put the same key in the meantime
+	lazy_block_ptr_t put(size_t key, lazy_block_ptr_t block) {
+	    shard& s = m_shards[key % num_shards];
+	    boost::mutex::scoped_lock lock(s.mutex);
+	    index_t::iterator found = s.index.find(key);
+	    if (found != s.index.end()) {
+		return found->second->second;
+	    }
+	    s.lru.push_front(std::make_pair(key, block));
+	    s.index[key] = s.lru.begin();
+	    s.bytes += block->length();
+	    // the iterators hold a reference to their block, so evicting it
+	    // only drops it from the cache
+	    while (s.bytes > m_shard_capacity && s.lru.size() > 1) {
+		s.bytes -= s.lru.back().second->length();
+		s.index.erase(s.lru.back().first);
+		s.lru.pop_back();
+		++s.stats.evictions;
 	    }
-	    assert(m_cache.size() < max_entries);
-	    m_cache[key] = std::make_pair(uint64_t(m_timestamp), block);
-	    tick();
+	    return block;
 	}
 
-	void tick() {
-	    ++m_timestamp;
-	    if (!m_timestamp) {
-		m_cache.clear();
+	cache_stats get_stats() {
+	    cache_stats stats;
+	    for (size_t i = 0; i < num_shards; ++i) {
+		boost::mutex::scoped_lock lock(m_shards[i].mutex);
+		stats.hits += m_shards[i].stats.hits;
+		stats.misses += m_shards[i].stats.misses;
+		stats.evictions += m_shards[i].stats.evictions;
 	    }
+	    return stats;
 	}
 
     private:
-	static const size_t max_entries = 8;
-	uint64_t m_timestamp;
-	typedef boost::unordered_map<size_t, std::pair<uint64_t, block_ptr_t> > cache_t;
-	cache_t m_cache;
+	static const size_t num_shards = 16;
+
+	typedef std::list<std::pair<size_t, lazy_block_ptr_t> > lru_t; // most recent first
+	typedef boost::unordered_map<size_t, lru_t::iterator> index_t;
+
+	struct shard {
+	    shard()
+		: bytes(0)
+	    {}
+
+	    boost::mutex mutex;
+	    lru_t lru;
+	    index_t index;
+	    size_t bytes;
+	    cache_stats stats;
+	};
+
+	size_t m_shard_capacity;
+	shard m_shards[num_shards];
     };
 
+    // granularity of the partial inflation
+    static const size_t inflate_step = 4096;
 
-    decompressor::decompressor(std::string const& filename)
+    void decompressor::iterator::load_block(size_t pos, size_t end) const
+    {
+	if (!m_block || pos < m_block_begin || pos >= m_block_limit) {
+	    size_t block_id = m_dec->block_of(pos);
+	    assert(block_id < m_dec->num_blocks());
+	    m_block = m_dec->get_block(block_id);
+	    m_block_begin = m_block->text().first;
+	    m_block_end = m_block_begin;
+	    m_block_limit = m_block_begin + m_block->length();
+	    m_data = m_block->length() ? &m_block->text().second[0] : 0;
+	}
+	size_t target = std::max(pos + 1, end) - m_block_begin;
+	target = (target + inflate_step - 1) / inflate_step * inflate_step;
+	m_block_end = m_block_begin + m_dec->inflate_block(*m_block, target);
+	assert(in_block(pos));
+    }
+
+    decompressor::decompressor(std::string const& filename, size_t cache_bytes)
         : m_mapped_file(filename)
-	, m_cache(new cache())
+	, m_cache(new cache(cache_bytes))
+        , m_inflated_bytes(0)
 #ifdef ZRANDOM_PROFILE
         , m_reads(0)
 #endif
@@ -137,58 +426,80 @@ namespace zrandom {
         data += succinct::mapper::map(m_original_size, data);
         data += succinct::mapper::map(m_block_size, data);
         data += succinct::mapper::map(m_offsets, data, succinct::mapper::map_flags::warmup);
+        if (data != m_mapped_file.data() + m_mapped_file.size()) {
+            data += succinct::mapper::map(m_block_starts, data, succinct::mapper::map_flags::warmup);
+        }
     }
     
     decompressor::~decompressor() 
     {
 #ifdef ZRANDOM_PROFILE
+        cache_stats stats = get_cache_stats();
         std::cerr << "**** Total reads: " << m_reads 
                   << ", Unique reads: " << m_unique_reads.size()
+                  << ", Cache hits: " << stats.hits
+                  << ", Cache evictions: " << stats.evictions
+                  << ", Inflated bytes: " << stats.inflated_bytes
                   << std::endl;
 #endif
     }
-        
-    decompressor::block_ptr_t decompressor::read_block(size_t block_id) const
+
+    decompressor::lazy_block_ptr_t decompressor::get_block(size_t block_id) const
     {
-	block_ptr_t cached_block_ptr = m_cache->get(block_id);
+	lazy_block_ptr_t cached_block_ptr = m_cache->get(block_id);
 	if (cached_block_ptr) {
 	    return cached_block_ptr;
 	}
-	
-	boost::shared_ptr<block_t> block_ptr(new block_t(block_id * block_size(), std::vector<char>())); // non-const ptr
-	std::vector<char>& block = block_ptr->second;
-
-        block.resize(m_block_size);
-        
-        z_stream strm;
-        int ret;
-        strm.zalloc = Z_NULL;
-        strm.zfree = Z_NULL;
-        strm.opaque = Z_NULL;
-        ret = inflateInit2(&strm, window_size);
-        assert(ret == Z_OK);
 
+	size_t begin = block_begin(block_id);
+	size_t length = ((block_id + 1 < num_blocks()) ? block_begin(block_id + 1) : m_original_size) - begin;
         size_t offset = m_offsets[block_id];
-            
-        strm.avail_in = m_compressed_size - offset;
-        strm.next_in = (unsigned char*)(m_compressed_data + offset);
+	lazy_block_ptr_t block_ptr(new lazy_block(begin, length, m_compressed_data + offset,
+						  m_compressed_size - offset));
 
-        strm.avail_out = m_block_size;
-        strm.next_out = (unsigned char*)&block[0];
+#ifdef ZRANDOM_PROFILE
+        {
+            boost::mutex::scoped_lock lock(m_stats_mutex);
+            ++m_reads;
+            m_unique_reads.insert(block_id);
+        }
+#endif
+	// if two threads miss on the same block, the first one inserted
+	// is kept, and only that one is ever inflated
+	return m_cache->put(block_id, block_ptr);
+    }
 
-        ret = inflate(&strm, Z_BLOCK);
-        assert(ret == Z_OK);
-        block.resize(m_block_size - strm.avail_out);
+    size_t decompressor::inflate_block(lazy_block& block, size_t end) const
+    {
+        size_t new_bytes;
+        size_t inflated = block.inflate_to(end, new_bytes);
+        if (new_bytes) {
+            boost::mutex::scoped_lock lock(m_stats_mutex);
+            m_inflated_bytes += new_bytes;
+        }
+        return inflated;
+    }
+        
+    decompressor::block_ptr_t decompressor::read_block(size_t block_id) const
+    {
+	lazy_block_ptr_t block = get_block(block_id);
+	inflate_block(*block, block->length());
+	// shares the ownership of the lazy block
+	return block_ptr_t(block, &block->text());
+    }
 
-        inflateEnd(&strm);
+    decompressor::cache_stats decompressor::get_cache_stats() const
+    {
+        cache_stats stats = m_cache->get_stats();
+        boost::mutex::scoped_lock lock(m_stats_mutex);
+        stats.inflated_bytes = m_inflated_bytes;
+        return stats;
+    }
 
-#ifdef ZRANDOM_PROFILE
-        ++m_reads;
-        m_unique_reads.insert(block_id);
-#endif
-	m_cache->put(block_id, block_ptr);
-	return block_ptr;
+    void decompressor::read_range(size_t begin, size_t end, std::string& out) const
+    {
+        detail::string_appender appender(out);
+        for_each_segment(begin, end, appender);
     }
     
 }
-
@@ -1,24 +1,70 @@
 #pragma once
 #include <set>
+#include <string>
+#include <algorithm>
 #include <stdint.h>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include "succinct/mappable_vector.hpp"
 
 namespace zrandom {
-    void compress(std::string const& in_filename, std::string const& out_filename);
+    static const size_t default_block_size = 16384;
 
+    // Compresses the file into blocks of block_size bytes that can be
+    // decompressed independently. The blocks are deflated at the given
+    // zlib level on the given number of threads, and written in order.
+    // With align_lines each block ends after the last newline that fits
+    // in block_size bytes, so that the lines shorter than a block are
+    // never split; the start of each block is then stored in the file
+    void compress(std::string const& in_filename, std::string const& out_filename,
+                  size_t threads = 1, int level = 9, size_t block_size = default_block_size,
+                  bool align_lines = false);
+
+    // Random access to a file compressed with compress(). The
+    // decompressed blocks are kept in a cache shared by all the
+    // iterators, which is safe to use from multiple threads, so a
+    // single decompressor can serve concurrent readers. The iterators
+    // inflate a block only up to the furthest position they access,
+    // and later accesses resume the inflation from there
     class decompressor {
+        class lazy_block;
+        typedef boost::shared_ptr<lazy_block> lazy_block_ptr_t;
+
     public:
-        decompressor(std::string const& filename);
+        static const size_t default_cache_bytes = 1 << 20;
+
+        // cache_bytes bounds the size of the decompressed blocks in the
+        // cache; each of its shards keeps at least the last block read.
+        // The inflate state of the partly decompressed blocks, about
+        // 40 KB each until the block is complete, is not included
+        decompressor(std::string const& filename, size_t cache_bytes = default_cache_bytes);
         ~decompressor();
         
 	typedef std::pair<size_t /* cur offset */, std::vector<char> /* cur block */> block_t;
 	typedef boost::shared_ptr<const block_t> block_ptr_t;
 
+	// the whole decompressed block
 	block_ptr_t read_block(size_t block_id) const;
+
+        struct cache_stats {
+            cache_stats()
+                : hits(0)
+                , misses(0)
+                , evictions(0)
+                , inflated_bytes(0)
+            {}
+
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            uint64_t inflated_bytes; // decompressed text, counted once
+        };
+
+        cache_stats get_cache_stats() const;
 	
+	// maximum size of a block
 	size_t block_size() const {
 	    return m_block_size;
 	}
@@ -26,7 +72,25 @@ namespace zrandom {
         size_t num_blocks() const {
             return m_offsets.size();
         }
+
+        // the block that contains the text position pos
+        size_t block_of(size_t pos) const {
+            if (!m_block_starts.size()) {
+                return pos / m_block_size;
+            }
+            return std::upper_bound(m_block_starts.begin(), m_block_starts.end(), uint64_t(pos))
+                - m_block_starts.begin() - 1;
+        }
+
+        // the text position of the first byte of the block
+        size_t block_begin(size_t block_id) const {
+            return m_block_starts.size() ? m_block_starts[block_id] : block_id * m_block_size;
+        }
         
+	// Random access iterator on the decompressed text. Each iterator
+	// keeps a reference to the block it last read, so that moving
+	// within its inflated part costs a single comparison; copies are
+	// cheap, and the blocks are read through the decompressor cache
 	class iterator
 	    : public boost::iterator_facade<
 	    iterator
@@ -36,8 +100,32 @@ namespace zrandom {
 	public:
 	    iterator()
 		: m_dec(0)
+		, m_absolute_pos(0)
+		, m_block_begin(0)
+		, m_block_end(0)
+		, m_block_limit(0)
+		, m_data(0)
 	    {}
 
+	    size_t position() const {
+		return m_absolute_pos;
+	    }
+
+	    // Calls f(first, last) on the contiguous pieces of the text in
+	    // [*this, last), one per block, in order
+	    template <typename Function>
+	    void for_each_segment(iterator const& last, Function& f) const {
+		size_t pos = m_absolute_pos;
+		while (pos < last.m_absolute_pos) {
+		    if (!in_block(pos)) {
+			load_block(pos, last.m_absolute_pos);
+		    }
+		    size_t segment_end = std::min(size_t(last.m_absolute_pos), m_block_end);
+		    f(m_data + (pos - m_block_begin), m_data + (segment_end - m_block_begin));
+		    pos = segment_end;
+		}
+	    }
+
 	private:
 	    friend class decompressor;
 	    friend class boost::iterator_core_access;
@@ -45,7 +133,10 @@ namespace zrandom {
 	    iterator(const decompressor* dec, size_t pos)
 		: m_dec(dec)
 		, m_absolute_pos(pos)
-		, m_cur_block(new block_ptr_t())
+		, m_block_begin(0)
+		, m_block_end(0)
+		, m_block_limit(0)
+		, m_data(0)
 	    {}
 
 	    bool equal(iterator const& other) const {
@@ -72,33 +163,31 @@ namespace zrandom {
 
 	    const char& dereference() const { 
 		assert(m_dec);
-		check_cur_block();
-		return (*m_cur_block)->second[m_absolute_pos - (*m_cur_block)->first]; 
+		if (!in_block(m_absolute_pos)) {
+		    load_block(m_absolute_pos);
+		}
+		return m_data[m_absolute_pos - m_block_begin];
 	    }
 
-	    bool pos_in_block() const {
-		return 
-		    (m_absolute_pos >= (*m_cur_block)->first) &&
-		    (m_absolute_pos < (*m_cur_block)->first + (*m_cur_block)->second.size());
+	    bool in_block(size_t pos) const {
+		// a single unsigned comparison checks both bounds; the empty
+		// range [0, 0) before the first read contains nothing
+		return pos - m_block_begin < m_block_end - m_block_begin;
 	    }
 
-	    void check_cur_block() const {
-		if (*m_cur_block && pos_in_block()) {
-		    // still in cur_block range, return
-		    return;
-		}
-		
-		size_t block_id = m_absolute_pos / m_dec->block_size();
-		assert(block_id < m_dec->num_blocks());
-
-		*m_cur_block = m_dec->read_block(block_id);
-		assert(pos_in_block());
-	    }
+	    // Moves to the block of pos, if needed, and inflates it at
+	    // least up to pos, or up to end if it is further
+	    void load_block(size_t pos, size_t end = 0) const;
 	    
 	    const decompressor* m_dec;
 	    size_t m_absolute_pos;
 
-	    boost::shared_ptr<block_ptr_t> m_cur_block;
+	    // last block read, inflated in [m_block_begin, m_block_end)
+	    mutable lazy_block_ptr_t m_block;
+	    mutable size_t m_block_begin;
+	    mutable size_t m_block_end;
+	    mutable size_t m_block_limit;
+	    mutable const char* m_data;
 	}; 
 
 	typedef iterator const_iterator;
@@ -111,20 +200,64 @@ namespace zrandom {
 	    return iterator(this, m_original_size);
 	}
 
+	// Calls f(first, last) on the contiguous pieces of the text in
+	// [begin, end), one per block, in order
+	template <typename Function>
+	void for_each_segment(size_t begin, size_t end, Function& f) const {
+	    iterator(this, begin).for_each_segment(iterator(this, end), f);
+	}
+
+	// Appends the text in [begin, end) to out
+	void read_range(size_t begin, size_t end, std::string& out) const;
+
     private:
+	friend class iterator;
+
+	lazy_block_ptr_t get_block(size_t block_id) const;
+	// Inflates the block up to the position end relative to the block,
+	// and returns the length of its inflated part
+	size_t inflate_block(lazy_block& block, size_t end) const;
+
         boost::iostreams::mapped_file_source m_mapped_file;
         const char* m_compressed_data;
         uint64_t m_original_size;
         uint64_t m_compressed_size;
         uint64_t m_block_size;
         succinct::mapper::mappable_vector<uint64_t> m_offsets;
+        // empty if the blocks have a fixed size
+        succinct::mapper::mappable_vector<uint64_t> m_block_starts;
 
 	class cache;
 	std::auto_ptr<cache> m_cache;
+        mutable boost::mutex m_stats_mutex;
+        mutable uint64_t m_inflated_bytes;
 
 #ifdef ZRANDOM_PROFILE
         mutable uint64_t m_reads;
         mutable std::set<uint64_t> m_unique_reads;
 #endif
     };
+
+    namespace detail {
+        struct string_appender {
+            string_appender(std::string& out)
+                : m_out(out)
+            {}
+
+            void operator()(const char* first, const char* last) {
+                m_out.append(first, last - first);
+            }
+
+            std::string& m_out;
+        };
+    }
+
+    // Overload of semi_index::detail::append_text, found by
+    // argument-dependent lookup, that copies whole blocks
+    inline void append_text(std::string& out, decompressor::iterator const& first,
+                            decompressor::iterator const& last)
+    {
+        detail::string_appender appender(out);
+        first.for_each_segment(last, appender);
+    }
 }